@@ -210,6 +210,8 @@ struct ast_array_literal {
 
 struct ast_expression_literal {
 	enum type_storage storage;
+	// If non-null, this is an array of u8 read by @embed
+	const struct packed_literal *packed;
 	union {
 		int64_t ival;
 		uint64_t uval;
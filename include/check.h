@@ -8,6 +8,7 @@
 #include "types.h"
 #include "type_store.h"
 
+struct eval_state;
 struct expression;
 
 #define MODCACHE_BUCKETS 256
@@ -15,6 +16,15 @@ struct expression;
 struct modcache {
 	struct identifier ident;
 	struct scope *scope;
+	// Set for modules compiled from source in this invocation, whose scope
+	// is NULL until they're checked; see module_add
+	const struct ast_unit *aunit;
+	struct unit *unit;
+	// Set for modules loaded from typedefs, whose declarations are resolved
+	// in this context on first use; see load_import
+	struct context *ctx;
+	const char *path;
+	bool in_progress;
 	struct modcache *next;
 };
 
@@ -39,6 +49,7 @@ struct context {
 	struct errors **next;
 	struct declarations *decls;
 	struct ast_types *unresolved;
+	struct eval_state *eval; // Set while running calls, see eval_initializer
 };
 
 struct constant_decl {
@@ -89,11 +100,14 @@ struct unit {
 	struct identifier *ns;
 	struct declarations *declarations;
 	struct identifiers *imports;
+	// Declarations loaded from typedefs, whose bodies may be inlined
+	struct declarations *imported;
 };
 
 enum idecl_type {
 	IDECL_DECL,
 	IDECL_ENUM_FLD,
+	IDECL_IMPORT,
 };
 
 // Keeps track of enum specific context required for enum field resolution
@@ -102,6 +116,13 @@ struct incomplete_enum_field {
 	struct scope *enum_scope;
 };
 
+// An object imported from a module loaded from typedefs, which is resolved in
+// that module's context when it's first looked up
+struct incomplete_import {
+	struct modcache *module;
+	struct scope_object *object;
+};
+
 // Keeps track of context required to resolve a declaration or an enum field
 // Extends the scope_object struct so it can be inserted into a scope
 struct incomplete_declaration {
@@ -110,9 +131,12 @@ struct incomplete_declaration {
 	enum idecl_type type;
 	bool in_progress;
 	bool dealias_in_progress;
+	bool checked; // Function body checked, see lookup_function
+	const struct declaration *func; // The checked function, if any
 	union {
 		struct ast_decl decl;
 		struct incomplete_enum_field *field;
+		struct incomplete_import import;
 	};
 };
 
@@ -135,7 +159,14 @@ void resolve_type(struct context *ctx,
 void wrap_resolver(struct context *ctx,
 	struct scope_object *obj, resolvefn resolver);
 
+// Returns the declaration of a function defined in this unit, checking its body
+// ahead of the rest of the unit if necessary. Returns NULL if obj isn't such a
+// function, or if its body can't be checked.
+const struct declaration *lookup_function(struct context *ctx,
+	const struct scope_object *obj);
+
 struct scope *check(type_store *ts,
+	struct modcache **cache,
 	bool is_test,
 	const char *mainsym,
 	const struct ast_global_decl *defines,
@@ -149,7 +180,7 @@ struct scope *check_internal(type_store *ts,
 	const struct ast_global_decl *defines,
 	const struct ast_unit *aunit,
 	struct unit *unit,
-	bool scan_only);
+	struct context **lazy);
 
 void check_expression(struct context *ctx,
 	const struct ast_expression *aexpr,
@@ -9,4 +9,9 @@ struct context;
 bool eval_expr(struct context *ctx, const struct expression *in,
 	struct expression *out);
 
+// Evaluates an initializer at compile time, running any calls it makes to
+// functions defined in this unit.
+bool eval_initializer(struct context *ctx, const struct expression *in,
+	struct expression *out);
+
 #endif
@@ -89,6 +89,7 @@ struct expression_alloc {
 	enum alloc_kind kind;
 	struct expression *init;
 	struct expression *cap;
+	bool stack; // Allocated on the stack, see opt_escape
 };
 
 struct expression_append {
@@ -195,6 +196,13 @@ struct array_literal {
 	struct array_literal *next;
 };
 
+// Array members stored contiguously in the target's byte order, rather than as
+// a list of expressions
+struct packed_literal {
+	size_t len; // In bytes
+	const char *data;
+};
+
 // Invariant: these are sorted by field offset
 struct struct_literal {
 	const struct struct_field *field;
@@ -216,6 +224,9 @@ struct tagged_literal {
 struct expression_literal {
 	// If non-null, ival is an offset from this object's address
 	const struct scope_object *object;
+	// If non-null, the members of this array are packed here and array is
+	// unused
+	const struct packed_literal *packed;
 	union {
 		bool bval;
 		double fval;
@@ -16,6 +16,10 @@ enum gen_value_kind {
 	GV_CONST,
 	GV_GLOBAL,
 	GV_TEMP,
+	// A scalar binding whose address is never taken, held directly in a
+	// QBE temporary instead of a stack slot. gen_load and gen_store treat
+	// it as an object; it has no address.
+	GV_PROMOTED,
 };
 
 struct gen_value {
@@ -34,14 +38,42 @@ struct gen_value {
 struct gen_binding {
 	const struct scope_object *object;
 	struct gen_value value;
+	// The data pointer and length of a slice or string binding which is
+	// never written after its initialization, if loaded; see
+	// gen_binding_header
+	struct qbe_value data, length;
 	struct gen_binding *next;
 };
 
+enum header_field {
+	HEADER_DATA = 1 << 0,
+	HEADER_LENGTH = 1 << 1,
+};
+
+// Fields of a slice or string binding's header which are read by indexing it
+// or taking its length
+struct gen_header_reads {
+	const struct scope_object *object;
+	unsigned int fields; // enum header_field
+};
+
 struct gen_defer {
 	const struct expression *expr;
+	// Entry to the scope's exit path which runs this defer and those
+	// before it; unused if name is NULL
+	struct qbe_statement label;
+	struct qbe_value blabel;
 	struct gen_defer *next;
 };
 
+// Where an exit path continues after running a scope's defers, selected by an
+// exit temporary; see gen_exit
+struct gen_route {
+	uint32_t id;
+	struct qbe_value dest;
+	struct gen_route *next;
+};
+
 struct gen_scope {
 	const char *label;
 	const struct scope *scope;
@@ -50,11 +82,24 @@ struct gen_scope {
 	struct qbe_value *after;
 	struct qbe_value *end;
 	struct gen_defer *defers;
+	struct gen_route *routes;
 	struct gen_scope *parent;
 };
 
+// Contents of the string literals in a unit, which are emitted once and shared
+// by every literal with the same contents
+struct gen_strlit {
+	const char *value;
+	size_t len;
+	char *data; // NULL for the empty string
+	char *header; // NULL until a str value is needed
+	struct gen_strlit *next;
+};
+
+#define STRLIT_BUCKETS 256
+
 struct rt {
-	struct qbe_value abort, ensure, fixedabort, free, malloc,
+	struct qbe_value abort, calloc, ensure, fixedabort, free, malloc,
 			 memcpy, memmove, memset, strcmp, unensure;
 };
 
@@ -65,6 +110,7 @@ struct gen_context {
 	struct identifier *ns;
 	struct rt rt;
 	struct gen_value *sources;
+	struct gen_strlit *strings[STRLIT_BUCKETS];
 
 	int id;
 
@@ -72,6 +118,33 @@ struct gen_context {
 	const struct type *functype;
 	struct gen_binding *bindings;
 	struct gen_scope *scope;
+
+	// Bindings in the current function whose address is taken; these are
+	// never promoted
+	const struct scope_object **addressed;
+	size_t naddressed, addressed_sz;
+	struct gen_header_reads *headers;
+	size_t nheaders, headers_sz;
+
+	// Fixed aborts in the current function branch, after running any
+	// defers, to a single call to rt.abort_fixed at the end of the function, which
+	// looks up the location and reason for the site in a table
+	struct qbe_def *aborts;
+	struct qbe_data_item *abort_item;
+	size_t naborts;
+	struct qbe_statement abortl;
+	struct qbe_value babort, abort_site;
+
+	// Exits through scopes with defers set the exit temporary and branch to
+	// blocks which run each scope's defers once; these are placed at the
+	// end of the function, followed by its shared return
+	struct qbe_statements pads;
+	struct gen_route *exits;
+	struct qbe_value exit;
+	struct qbe_statement retl;
+	struct qbe_value bret;
+	struct gen_value retval;
+	char *sources_table;
 };
 
 struct unit;
@@ -9,6 +9,7 @@
 
 // Keep sorted
 enum lexical_token {
+	T_ATTR_EMBED,
 	T_ATTR_FINI,
 	T_ATTR_INIT,
 	T_ATTR_OFFSET,
@@ -2,11 +2,29 @@
 #define HARE_MOD_H
 #include "identifier.h"
 #include "scope.h"
+#include "type_store.h"
 
 struct ast_global_decl;
+struct ast_unit;
 struct context;
-struct scope *module_resolve(struct context *ctx,
+struct modcache;
+struct unit;
+
+// Returns the module, checking it first if it was added with module_add or
+// loading its typedefs.
+struct modcache *module_resolve(struct context *ctx,
 	const struct ast_global_decl *defines,
 	const struct identifier *ident);
 
+// Adds a module to be compiled from source alongside the main unit, rather
+// than loaded from its typedefs. It's checked when it is first imported, and
+// unit receives its declarations.
+void module_add(struct modcache **cache, const struct identifier *ident,
+	const struct ast_unit *aunit, struct unit *unit);
+
+// Checks each module added with module_add which wasn't imported by the main
+// unit.
+void module_check_all(type_store *ts, struct modcache **cache,
+	const char *mainsym, const struct ast_global_decl *defines);
+
 #endif
@@ -0,0 +1,54 @@
+#ifndef HAREC_OPT_H
+#define HAREC_OPT_H
+#include <stdbool.h>
+#include "check.h"
+#include "expr.h"
+
+// Called for each subexpression visited by expr_walk. The visitor may replace
+// the subexpression by writing to *slot. If it returns false, the
+// subexpressions of *slot are not visited.
+typedef bool (*expr_visitor)(struct expression **slot, void *user);
+
+// Visits each subexpression of expr in evaluation order (expr itself is not
+// visited).
+void expr_walk(struct expression *expr, expr_visitor visit, void *user);
+
+// Returns a deep copy of expr. Scopes, scope objects, and types are shared with
+// the original.
+struct expression *expr_copy(const struct expression *expr);
+
+// Returns true if expr is an identifier access of obj.
+bool expr_is_ident(const struct expression *expr, const struct scope_object *obj);
+
+// Maximum number of subexpressions in a function body which is inlined, or
+// which is written to the typedefs so that importers can inline it
+#define INLINE_BUDGET 32
+
+// Runs optimization passes over the checked unit. At level 0, no passes are
+// run, and at level 2 and above inlining ignores its size budget. mainsym is
+// the symbol of the hosted main function, or "" if there is none.
+void optimize(struct unit *unit, const char *mainsym, int level);
+
+// bounds.c
+void opt_bounds(struct declaration *decl);
+
+// escape.c
+void opt_escape(struct declaration *decl);
+
+// fold.c
+void opt_fold(struct declaration *decl);
+
+// inline.c
+void opt_inline(struct unit *unit, int level);
+
+// prune.c
+void opt_prune(struct unit *unit, const char *mainsym);
+
+// peephole.c
+struct qbe_program;
+
+// Simplifies the IR of each function in prog, returning the number of
+// instructions removed.
+size_t opt_peephole(struct qbe_program *prog);
+
+#endif
@@ -188,7 +188,12 @@ struct qbe_statement {
 			struct qbe_value *out;
 			struct qbe_arguments *args;
 		};
-		char *label;
+		struct {
+			char *label;
+			// Only reached on unlikely paths, such as errors and
+			// aborts; see gen_layout
+			bool cold;
+		};
 		char *comment;
 	};
 };
@@ -239,6 +244,8 @@ struct qbe_data {
 	size_t align;
 	char *section, *secflags;
 	bool threadlocal;
+	// Never written to; placed in a read-only section
+	bool readonly;
 	struct qbe_data_item items;
 };
 
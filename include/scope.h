@@ -58,6 +58,9 @@ struct scope {
 	struct type_tagged_union *results;
 	struct yield *yields;
 
+	// Completes incomplete objects found in this scope on lookup
+	void (*resolve)(struct scope_object *obj);
+
 	// Linked list in insertion order
 	// Used for function parameters and enum values, where order matters
 	struct scope_object *objects;
@@ -1,11 +1,12 @@
 #ifndef HARE_TYPEDEF_H
 #define HARE_TYPEDEF_H
+#include <stdbool.h>
 #include <stdio.h>
 
 struct type;
 struct unit;
 
 void emit_type(const struct type *type, FILE *out);
-void emit_typedefs(struct unit *unit, FILE *out);
+void emit_typedefs(struct unit *unit, bool bodies, FILE *out);
 
 #endif
@@ -1,4 +1,5 @@
-TDENV = env HARE_TD_rt=$(HARECACHE)/rt.td HARE_TD_testmod=$(HARECACHE)/testmod.td
+TDENV = env HARE_TD_rt=$(HARECACHE)/rt.td HARE_TD_testmod=$(HARECACHE)/testmod.td \
+	HARE_TD_lazy=tests/24-lazy.td
 test_objects = \
 	src/lex.o \
 	src/parse.o \
@@ -70,6 +71,7 @@ tests = \
 	tests/22-delete \
 	tests/23-errors \
 	tests/24-imports \
+	tests/24-imports-program \
 	tests/25-promotion \
 	tests/26-regression \
 	tests/27-rt \
@@ -210,7 +212,7 @@ tests/11-globals: $(HARECACHE)/rt.o $(HARECACHE)/tests_11_globals.o
 	@$(LD) $(LDLINKFLAGS) -T $(RTSCRIPT) -o $@ $(HARECACHE)/rt.o $(HARECACHE)/tests_11_globals.o
 
 tests_11_globals_ha = tests/11-globals.ha
-$(HARECACHE)/tests_11_globals.ssa: $(tests_11_globals_ha) $(HARECACHE)/rt.td $(BINOUT)/harec
+$(HARECACHE)/tests_11_globals.ssa: $(tests_11_globals_ha) tests/11-globals.dat $(HARECACHE)/rt.td $(BINOUT)/harec
 	@mkdir -p -- $(HARECACHE)
 	@printf 'HAREC\t%s\n' '$@'
 	@$(TDENV) $(BINOUT)/harec $(HARECFLAGS) -o $@ $(tests_11_globals_ha)
@@ -359,6 +361,22 @@ $(HARECACHE)/tests_24_imports.ssa: $(tests_24_imports_ha) $(HARECACHE)/rt.td $(H
 	@$(TDENV) $(BINOUT)/harec $(HARECFLAGS) -o $@ $(tests_24_imports_ha)
 
 
+# tests/24-imports again, built into one program with rt and testmod
+tests/24-imports-program: $(HARECACHE)/tests_24_imports_program.o
+	@printf 'LD\t%s\t\n' '$@'
+	@$(LD) $(LDLINKFLAGS) -T $(RTSCRIPT) -o $@ $(HARECACHE)/tests_24_imports_program.o
+
+$(HARECACHE)/tests_24_imports_program.o: $(HARECACHE)/tests_24_imports_program.s $(_rt_s)
+	@printf 'AS\t%s\n' '$@'
+	@$(AS) $(ASFLAGS) -o $@ $(HARECACHE)/tests_24_imports_program.s $(_rt_s)
+
+$(HARECACHE)/tests_24_imports_program.ssa: $(tests_24_imports_ha) $(rt_ha) $(testmod_ha) $(BINOUT)/harec
+	@mkdir -p -- $(HARECACHE)
+	@printf 'HAREC\t%s\n' '$@'
+	@$(BINOUT)/harec $(HARECFLAGS) -o $@ $(tests_24_imports_ha) \
+		rt:: $(rt_ha) testmod:: $(testmod_ha)
+
+
 tests/25-promotion: $(HARECACHE)/rt.o $(HARECACHE)/tests_25_promotion.o
 	@printf 'LD\t%s\t\n' '$@'
 	@$(LD) $(LDLINKFLAGS) -T $(RTSCRIPT) -o $@ $(HARECACHE)/rt.o $(HARECACHE)/tests_25_promotion.o
@@ -11,6 +11,11 @@ SECTIONS {
 		KEEP (*(.text))
 		*(.text.*)
 	} :text
+
+	.rodata : {
+		KEEP (*(.rodata))
+		*(.rodata.*)
+	} :text
 	. = 0x80000000;
 	.data : {
 		KEEP (*(.data))
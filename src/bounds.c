@@ -0,0 +1,476 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include "check.h"
+#include "expr.h"
+#include "opt.h"
+#include "scope.h"
+#include "types.h"
+#include "util.h"
+
+// Bounds check elimination
+//
+// Within the body of a loop (or the true branch of an if) whose condition
+// establishes i < len(x) or i < N, an index x[i] is known to be in bounds,
+// provided that neither i nor x can change in the meantime. Indicies are
+// always of type size, so the lower bound is implied.
+//
+// Separately, len(x) of a loop-invariant slice or string is hoisted out of
+// the loop into a binding evaluated once before it.
+
+struct bounds_fact {
+	// index < len(slice) if slice is set, otherwise index < length
+	const struct scope_object *index;
+	const struct scope_object *slice;
+	size_t length;
+	struct bounds_fact *next;
+};
+
+struct bounds_state {
+	// Bindings whose address is taken anywhere in the function
+	const struct scope_object **addressed;
+	size_t naddressed, addressed_sz;
+	struct bounds_fact *facts;
+};
+
+static void
+objects_append(const struct scope_object ***objs, size_t *n, size_t *sz,
+	const struct scope_object *obj)
+{
+	if (*n >= *sz) {
+		*sz = *sz ? *sz * 2 : 16;
+		*objs = xrealloc(*objs, *sz * sizeof(**objs));
+	}
+	(*objs)[(*n)++] = obj;
+}
+
+static bool
+objects_contain(const struct scope_object **objs, size_t n,
+	const struct scope_object *obj)
+{
+	for (size_t i = 0; i < n; ++i) {
+		if (objs[i] == obj) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool
+collect_addressed(struct expression **slot, void *user)
+{
+	struct bounds_state *state = user;
+	struct expression *expr = *slot;
+	if (expr->type == EXPR_UNARITHM && expr->unarithm.op == UN_ADDRESS
+			&& expr->unarithm.operand->type == EXPR_ACCESS
+			&& expr->unarithm.operand->access.type == ACCESS_IDENTIFIER) {
+		objects_append(&state->addressed, &state->naddressed,
+			&state->addressed_sz, expr->unarithm.operand->access.object);
+	}
+	return true;
+}
+
+struct modification {
+	const struct scope_object *object;
+	bool modified;
+};
+
+// Finds expressions which replace the value of a binding outright: these are
+// assignments to it and, for slices, append, insert and delete.
+static bool
+find_modification(struct expression **slot, void *user)
+{
+	struct modification *mod = user;
+	const struct expression *expr = *slot, *target = NULL;
+	switch (expr->type) {
+	case EXPR_ASSIGN:
+		target = expr->assign.object;
+		break;
+	case EXPR_APPEND:
+	case EXPR_INSERT:
+		target = expr->append.object;
+		break;
+	case EXPR_DELETE:
+		target = expr->delete.expr;
+		if (target->type == EXPR_SLICE) {
+			target = target->slice.object;
+		} else if (target->type == EXPR_ACCESS
+				&& target->access.type == ACCESS_INDEX) {
+			target = target->access.array;
+		}
+		break;
+	default:
+		break;
+	}
+	if (target && expr_is_ident(target, mod->object)) {
+		mod->modified = true;
+	}
+	return !mod->modified;
+}
+
+static bool
+modifies(struct expression *expr, const struct scope_object *obj)
+{
+	if (expr == NULL) {
+		return false;
+	}
+	struct modification mod = { .object = obj };
+	if (find_modification(&expr, &mod)) {
+		expr_walk(expr, find_modification, &mod);
+	}
+	return mod.modified;
+}
+
+// Returns true if obj is a local binding whose value is only changed by the
+// expressions in which it appears.
+static bool
+is_local(struct bounds_state *state, const struct scope_object *obj)
+{
+	return obj->otype == O_BIND
+		&& !objects_contain(state->addressed, state->naddressed, obj);
+}
+
+static void
+cond_facts(struct bounds_state *state, const struct expression *cond,
+	struct bounds_fact **facts)
+{
+	if (cond->type != EXPR_BINARITHM) {
+		return;
+	}
+
+	const struct expression *index, *bound;
+	switch (cond->binarithm.op) {
+	case BIN_LAND:
+		cond_facts(state, cond->binarithm.lvalue, facts);
+		cond_facts(state, cond->binarithm.rvalue, facts);
+		return;
+	case BIN_LESS:
+		index = cond->binarithm.lvalue;
+		bound = cond->binarithm.rvalue;
+		break;
+	case BIN_GREATER:
+		index = cond->binarithm.rvalue;
+		bound = cond->binarithm.lvalue;
+		break;
+	default:
+		return;
+	}
+
+	if (index->type != EXPR_ACCESS
+			|| index->access.type != ACCESS_IDENTIFIER
+			|| !is_local(state, index->access.object)
+			|| type_dealias(NULL, index->result)->storage != STORAGE_SIZE) {
+		return;
+	}
+
+	struct bounds_fact fact = {
+		.index = index->access.object,
+	};
+	if (bound->type == EXPR_LEN) {
+		const struct expression *value = bound->len.value;
+		const struct type *type = type_dealias(NULL,
+			type_dereference(NULL, value->result));
+		if (type->storage == STORAGE_ARRAY) {
+			assert(type->array.length != SIZE_UNDEFINED);
+			fact.length = type->array.length;
+		} else if (type->storage == STORAGE_SLICE
+				&& value->type == EXPR_ACCESS
+				&& value->access.type == ACCESS_IDENTIFIER
+				&& is_local(state, value->access.object)
+				&& type_dealias(NULL, value->result)->storage
+					== STORAGE_SLICE) {
+			fact.slice = value->access.object;
+		} else {
+			return;
+		}
+	} else if (bound->type == EXPR_LITERAL
+			&& type_dealias(NULL, bound->result)->storage == STORAGE_SIZE) {
+		fact.length = bound->literal.uval;
+	} else {
+		return;
+	}
+
+	struct bounds_fact *new = xcalloc(1, sizeof(struct bounds_fact));
+	*new = fact;
+	new->next = *facts;
+	*facts = new;
+}
+
+// Pushes the facts established by cond which hold throughout each of the
+// given expressions.
+static struct bounds_fact *
+push_facts(struct bounds_state *state, struct expression *cond,
+	struct expression *body)
+{
+	struct bounds_fact *prev = state->facts, *facts = NULL;
+	cond_facts(state, cond, &facts);
+	while (facts) {
+		struct bounds_fact *fact = facts;
+		facts = facts->next;
+		if (modifies(cond, fact->index) || modifies(body, fact->index)
+				|| (fact->slice && (modifies(cond, fact->slice)
+					|| modifies(body, fact->slice)))) {
+			free(fact);
+			continue;
+		}
+		fact->next = state->facts;
+		state->facts = fact;
+	}
+	return prev;
+}
+
+static void
+pop_facts(struct bounds_state *state, struct bounds_fact *prev)
+{
+	while (state->facts != prev) {
+		struct bounds_fact *fact = state->facts;
+		state->facts = fact->next;
+		free(fact);
+	}
+}
+
+static bool
+index_in_bounds(struct bounds_state *state, const struct expression *expr)
+{
+	const struct expression *array = expr->access.array;
+	const struct expression *index = expr->access.index;
+	if (index->type != EXPR_ACCESS
+			|| index->access.type != ACCESS_IDENTIFIER) {
+		return false;
+	}
+	const struct type *type = type_dealias(NULL,
+		type_dereference(NULL, array->result));
+	for (const struct bounds_fact *fact = state->facts;
+			fact; fact = fact->next) {
+		if (fact->index != index->access.object) {
+			continue;
+		}
+		if (fact->slice && expr_is_ident(array, fact->slice)) {
+			return true;
+		}
+		if (!fact->slice && type->storage == STORAGE_ARRAY
+				&& type->array.length != SIZE_UNDEFINED
+				&& fact->length <= type->array.length) {
+			return true;
+		}
+	}
+	return false;
+}
+
+struct hoisted_len {
+	const struct scope_object *object;
+	const struct scope_object *len; // NULL if object is not invariant
+	struct hoisted_len *next;
+};
+
+struct hoist {
+	struct bounds_state *state;
+	struct expression *loop;
+	// Bindings declared within the loop
+	const struct scope_object **declared;
+	size_t ndeclared, declared_sz;
+	struct hoisted_len *hoisted;
+};
+
+static bool
+collect_declared(struct expression **slot, void *user)
+{
+	struct hoist *hoist = user;
+	const struct expression *expr = *slot;
+	switch (expr->type) {
+	case EXPR_BINDING:
+		for (const struct expression_binding *binding = &expr->binding;
+				binding; binding = binding->next) {
+			if (binding->object) {
+				objects_append(&hoist->declared, &hoist->ndeclared,
+					&hoist->declared_sz, binding->object);
+			}
+			for (const struct binding_unpack *unpack = binding->unpack;
+					unpack; unpack = unpack->next) {
+				objects_append(&hoist->declared, &hoist->ndeclared,
+					&hoist->declared_sz, unpack->object);
+			}
+		}
+		break;
+	case EXPR_MATCH:
+		for (const struct match_case *_case = expr->match.cases;
+				_case; _case = _case->next) {
+			objects_append(&hoist->declared, &hoist->ndeclared,
+				&hoist->declared_sz, _case->object);
+		}
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+static const struct scope_object *
+hoist_len(struct hoist *hoist, struct expression *len)
+{
+	const struct scope_object *obj = len->len.value->access.object;
+	for (struct hoisted_len *h = hoist->hoisted; h; h = h->next) {
+		if (h->object == obj) {
+			return h->len;
+		}
+	}
+
+	struct expression *loop = hoist->loop;
+	struct hoisted_len *h = xcalloc(1, sizeof(struct hoisted_len));
+	h->object = obj;
+	h->next = hoist->hoisted;
+	hoist->hoisted = h;
+	if (!is_local(hoist->state, obj)
+			|| objects_contain(hoist->declared, hoist->ndeclared, obj)
+			|| modifies(loop->_for.cond, obj)
+			|| modifies(loop->_for.body, obj)
+			|| modifies(loop->_for.afterthought, obj)) {
+		return NULL;
+	}
+
+	struct scope_object *lenobj = xcalloc(1, sizeof(struct scope_object));
+	struct identifier ident = { .name = "len" };
+	scope_object_init(lenobj, O_BIND, &ident, &ident,
+		&builtin_type_size, NULL);
+	h->len = lenobj;
+
+	struct expression_binding *binding;
+	if (loop->_for.bindings == NULL) {
+		struct expression *bindings = xcalloc(1, sizeof(struct expression));
+		bindings->type = EXPR_BINDING;
+		bindings->result = &builtin_type_void;
+		bindings->loc = loop->loc;
+		loop->_for.bindings = bindings;
+		binding = &bindings->binding;
+	} else {
+		binding = &loop->_for.bindings->binding;
+		while (binding->next) {
+			binding = binding->next;
+		}
+		binding->next = xcalloc(1, sizeof(struct expression_binding));
+		binding = binding->next;
+	}
+	binding->object = lenobj;
+	binding->initializer = len;
+	return lenobj;
+}
+
+static bool
+hoist_visit(struct expression **slot, void *user)
+{
+	struct hoist *hoist = user;
+	struct expression *expr = *slot;
+	if (expr->type != EXPR_LEN) {
+		return true;
+	}
+	const struct expression *value = expr->len.value;
+	if (value->type != EXPR_ACCESS
+			|| value->access.type != ACCESS_IDENTIFIER) {
+		return true;
+	}
+	enum type_storage storage = type_dealias(NULL, value->result)->storage;
+	if (storage != STORAGE_SLICE && storage != STORAGE_STRING) {
+		return true;
+	}
+
+	const struct scope_object *len = hoist_len(hoist, expr);
+	if (len == NULL) {
+		return true;
+	}
+	struct expression *access = xcalloc(1, sizeof(struct expression));
+	access->type = EXPR_ACCESS;
+	access->result = &builtin_type_size;
+	access->loc = expr->loc;
+	access->access.type = ACCESS_IDENTIFIER;
+	access->access.object = len;
+	*slot = access;
+	return false;
+}
+
+static void
+hoist_lengths(struct bounds_state *state, struct expression *loop)
+{
+	struct hoist hoist = {
+		.state = state,
+		.loop = loop,
+	};
+	expr_walk(loop->_for.cond, collect_declared, &hoist);
+	expr_walk(loop->_for.body, collect_declared, &hoist);
+	if (loop->_for.afterthought) {
+		expr_walk(loop->_for.afterthought, collect_declared, &hoist);
+	}
+
+	hoist_visit(&loop->_for.cond, &hoist);
+	expr_walk(loop->_for.cond, hoist_visit, &hoist);
+	hoist_visit(&loop->_for.body, &hoist);
+	expr_walk(loop->_for.body, hoist_visit, &hoist);
+	if (loop->_for.afterthought) {
+		hoist_visit(&loop->_for.afterthought, &hoist);
+		expr_walk(loop->_for.afterthought, hoist_visit, &hoist);
+	}
+
+	while (hoist.hoisted) {
+		struct hoisted_len *h = hoist.hoisted;
+		hoist.hoisted = h->next;
+		free(h);
+	}
+	free(hoist.declared);
+}
+
+static bool bounds_visit(struct expression **slot, void *user);
+
+static void
+bounds_expr(struct bounds_state *state, struct expression **slot)
+{
+	if (*slot && bounds_visit(slot, state)) {
+		expr_walk(*slot, bounds_visit, state);
+	}
+}
+
+static bool
+bounds_visit(struct expression **slot, void *user)
+{
+	struct bounds_state *state = user;
+	struct expression *expr = *slot;
+	struct bounds_fact *prev;
+	switch (expr->type) {
+	case EXPR_ACCESS:
+		if (expr->access.type == ACCESS_INDEX
+				&& !expr->access.bounds_checked
+				&& index_in_bounds(state, expr)) {
+			expr->access.bounds_checked = true;
+		}
+		return true;
+	case EXPR_FOR:
+		bounds_expr(state, &expr->_for.bindings);
+		bounds_expr(state, &expr->_for.cond);
+		prev = push_facts(state, expr->_for.cond, expr->_for.body);
+		bounds_expr(state, &expr->_for.body);
+		pop_facts(state, prev);
+		bounds_expr(state, &expr->_for.afterthought);
+		hoist_lengths(state, expr);
+		return false;
+	case EXPR_IF:
+		bounds_expr(state, &expr->_if.cond);
+		prev = push_facts(state, expr->_if.cond, expr->_if.true_branch);
+		bounds_expr(state, &expr->_if.true_branch);
+		pop_facts(state, prev);
+		bounds_expr(state, &expr->_if.false_branch);
+		return false;
+	default:
+		return true;
+	}
+}
+
+void
+opt_bounds(struct declaration *decl)
+{
+	struct bounds_state state = {0};
+	struct expression *body = decl->func.body;
+	collect_addressed(&body, &state);
+	expr_walk(body, collect_addressed, &state);
+	bounds_expr(&state, &decl->func.body);
+	assert(state.facts == NULL);
+	free(state.addressed);
+}
@@ -477,6 +477,10 @@ check_expr_alloc_slice(struct context *ctx,
 				c != NULL; c = c->next) {
 			len++;
 		}
+		if (expr->alloc.init->literal.packed) {
+			len = expr->alloc.init->literal.packed->len
+				/ type_dealias(ctx, objtype)->array.members->size;
+		}
 		if (cap.literal.uval < len) {
 			error(ctx, aexpr->alloc.cap->loc, expr,
 				"Slice capacity cannot be smaller than length of initializer");
@@ -1219,9 +1223,12 @@ check_binding_unpack(struct context *ctx,
 			};
 
 			if (abinding->is_static) {
-				struct identifier gen = {0};
-
-				// Generate a static declaration identifier
+				// Generate a static declaration identifier, within
+				// the module's namespace so that it's unique among
+				// modules built together
+				struct identifier gen = {
+					.ns = ctx->ns,
+				};
 				gen.name = gen_name(&ctx->id, "static.%d");
 
 				unpack->object = scope_insert(
@@ -1325,7 +1332,7 @@ check_expr_binding(struct context *ctx,
 			}
 			struct expression *value =
 				xcalloc(1, sizeof(struct expression));
-			if (!eval_expr(ctx, initializer, value)) {
+			if (!eval_initializer(ctx, initializer, value)) {
 				error(ctx, initializer->loc, value,
 					"Unable to evaluate constant init at compile time");
 				type = &builtin_type_error;
@@ -1341,7 +1348,9 @@ check_expr_binding(struct context *ctx,
 		}
 		if (abinding->is_static) {
 			// Generate a static declaration identifier
-			struct identifier gen = {0};
+			struct identifier gen = {
+				.ns = ctx->ns,
+			};
 			gen.name = gen_name(&ctx->id, "static.%d");
 			binding->object = scope_insert(ctx->scope,
 				O_DECL, &gen, &ident, type, NULL);
@@ -1625,12 +1634,82 @@ check_expr_cast(struct context *ctx,
 	expr->result = aexpr->cast.kind == C_TEST? &builtin_type_bool : secondary;
 }
 
+// Array literals of at least this many integer constants are packed
+#define PACKED_ARRAY_MIN 32
+
+// Returns the value of a constant array member, or false if it isn't one
+static bool
+packed_member(const struct expression *expr, uint64_t *val)
+{
+	bool negate = false;
+	if (expr->type == EXPR_UNARITHM && expr->unarithm.op == UN_MINUS) {
+		negate = true;
+		expr = expr->unarithm.operand;
+	}
+	if (expr->type != EXPR_LITERAL || expr->literal.object) {
+		return false;
+	}
+	*val = negate ? -expr->literal.uval : expr->literal.uval;
+	return true;
+}
+
+// Packs the members of an array literal into bytes, if they are all constants
+// of a builtin integer type
+static void
+pack_array(struct expression *expr, const struct type *membtype, size_t len)
+{
+	switch (membtype->storage) {
+	case STORAGE_I8:
+	case STORAGE_I16:
+	case STORAGE_I32:
+	case STORAGE_I64:
+	case STORAGE_INT:
+	case STORAGE_U8:
+	case STORAGE_U16:
+	case STORAGE_U32:
+	case STORAGE_U64:
+	case STORAGE_UINT:
+	case STORAGE_SIZE:
+		break;
+	default:
+		return;
+	}
+
+	size_t size = membtype->size;
+	char *data = xcalloc(len, size);
+	struct array_literal *item = expr->literal.array;
+	for (size_t i = 0; i < len; ++i, item = item->next) {
+		uint64_t val;
+		if (item->value->result != membtype
+				|| !packed_member(item->value, &val)) {
+			free(data);
+			return;
+		}
+		for (size_t j = 0; j < size; ++j) {
+			data[i * size + j] = (char)(val >> (j * 8));
+		}
+	}
+
+	struct packed_literal *packed = xcalloc(1, sizeof(*packed));
+	packed->len = len * size;
+	packed->data = data;
+	expr->literal.array = NULL;
+	expr->literal.packed = packed;
+}
+
 static void
 check_expr_array(struct context *ctx,
 	const struct ast_expression *aexpr,
 	struct expression *expr,
 	const struct type *hint)
 {
+	if (aexpr->literal.packed) {
+		expr->literal.packed = aexpr->literal.packed;
+		expr->result = type_store_lookup_array(ctx, aexpr->loc,
+			&builtin_type_u8, aexpr->literal.packed->len, false);
+		return;
+	}
+
 	size_t len = 0;
 	bool expand = false;
 	struct ast_array_literal *item = aexpr->literal.array;
@@ -1712,6 +1791,9 @@ check_expr_array(struct context *ctx,
 		error(ctx, aexpr->loc, expr, "Cannot infer array type from context, try casting it to the desired type");
 		return;
 	}
+	if (!expand && len >= PACKED_ARRAY_MIN) {
+		pack_array(expr, type, len);
+	}
 	expr->result = type_store_lookup_array(ctx, aexpr->loc,
 			type, len, expand);
 }
@@ -3630,13 +3712,14 @@ check_expression(struct context *ctx,
 	flexible_refer(expr->result, &expr->result);
 }
 
-static void
+static const struct declaration *
 append_decl(struct context *ctx, struct declaration *decl)
 {
 	struct declarations *decls = xcalloc(1, sizeof(struct declarations));
 	decls->decl = *decl;
 	decls->next = ctx->decls;
 	ctx->decls = decls;
+	return &decls->decl;
 }
 
 static void
@@ -3650,11 +3733,16 @@ resolve_unresolved(struct context *ctx)
 	}
 }
 
-void
-check_function(struct context *ctx,
-	const struct scope_object *obj,
-	const struct ast_decl *adecl)
+static void
+check_function(struct context *ctx, struct incomplete_declaration *idecl)
 {
+	if (idecl->checked) {
+		return;
+	}
+	idecl->checked = true;
+
+	const struct scope_object *obj = &idecl->obj;
+	const struct ast_decl *adecl = &idecl->decl;
 	const struct ast_function_decl *afndecl = &adecl->function;
 	ctx->fntype = obj->type;
 	if (ctx->fntype->storage == STORAGE_ERROR) {
@@ -3761,7 +3849,55 @@ end:
 	if ((adecl->function.flags & FN_TEST) && !ctx->is_test) {
 		return;
 	}
-	append_decl(ctx, decl);
+	idecl->func = append_decl(ctx, decl);
+}
+
+static const struct declaration *complete_function(struct context *ctx,
+	struct incomplete_declaration *idecl);
+
+const struct declaration *
+lookup_function(struct context *ctx, const struct scope_object *obj)
+{
+	struct incomplete_declaration *idecl = NULL;
+	for (struct scope_object *o = ctx->unit->objects; o; o = o->lnext) {
+		if (o == obj) {
+			idecl = (struct incomplete_declaration *)o;
+			break;
+		}
+	}
+	if (!idecl || idecl->type != IDECL_DECL
+			|| idecl->decl.decl_type != ADECL_FUNC) {
+		return NULL;
+	}
+	return complete_function(ctx, idecl);
+}
+
+static const struct declaration *
+complete_function(struct context *ctx, struct incomplete_declaration *idecl)
+{
+	if (idecl->checked) {
+		return idecl->func;
+	}
+
+	// save current context, as in wrap_resolver
+	struct scope *scope = ctx->scope;
+	struct scope *subunit = ctx->unit->parent;
+	const struct type *fntype = ctx->fntype;
+	struct ast_types *unresolved = ctx->unresolved;
+	struct eval_state *eval = ctx->eval;
+	ctx->scope = ctx->defines;
+	ctx->unit->parent = idecl->imports;
+	ctx->unresolved = NULL;
+	ctx->eval = NULL;
+
+	check_function(ctx, idecl);
+
+	ctx->eval = eval;
+	ctx->unresolved = unresolved;
+	ctx->fntype = fntype;
+	ctx->unit->parent = subunit;
+	ctx->scope = scope;
+	return idecl->func;
 }
 
 static struct incomplete_declaration *
@@ -4047,7 +4183,7 @@ resolve_const(struct context *ctx, struct incomplete_declaration *idecl)
 		}
 	}
 
-	if (!eval_expr(ctx, init, value)) {
+	if (!eval_initializer(ctx, init, value)) {
 		error(ctx, decl->init->loc, value,
 			"Unable to evaluate initializer at compile time");
 		type = &builtin_type_error;
@@ -4185,7 +4321,7 @@ resolve_global(struct context *ctx, struct incomplete_declaration *idecl)
 			type = &builtin_type_error;
 			goto end;
 		}
-		if (!eval_expr(ctx, init, value)) {
+		if (!eval_initializer(ctx, init, value)) {
 			error(ctx, decl->init->loc, value,
 				"Unable to evaluate initializer at compile time");
 			type = &builtin_type_error;
@@ -4542,6 +4678,7 @@ scan_decl(struct context *ctx, struct scope *imports, const struct ast_decl *dec
 			}
 			assert(template);
 			ident.name = gen_name(&ctx->id, template);
+			ident.ns = ctx->ns;
 			++ctx->id;
 
 			name = &ident;
@@ -4593,6 +4730,8 @@ resolve_decl(struct context *ctx, struct incomplete_declaration *idecl)
 		return;
 	case IDECL_DECL:
 		break;
+	case IDECL_IMPORT:
+		assert(0); // Resolved on lookup
 	}
 
 	switch (idecl->decl.decl_type) {
@@ -4663,11 +4802,68 @@ wrap_resolver(struct context *ctx, struct scope_object *obj, resolvefn resolver)
 	ctx->scope = scope;
 }
 
+// Resolves an object imported from a module loaded from typedefs in that
+// module's context
+static void
+resolve_import(struct scope_object *obj)
+{
+	struct incomplete_declaration *idecl =
+		(struct incomplete_declaration *)obj;
+	assert(idecl->type == IDECL_IMPORT);
+	struct modcache *mod = idecl->import.module;
+	struct scope_object *target = idecl->import.object;
+
+	const char *source = sources[0];
+	sources[0] = mod->path;
+	wrap_resolver(mod->ctx, target, resolve_decl);
+	struct incomplete_declaration *tdecl =
+		(struct incomplete_declaration *)target;
+	if (tdecl->type == IDECL_DECL && tdecl->decl.decl_type == ADECL_FUNC) {
+		// Its body may be inlined, see opt_inline
+		complete_function(mod->ctx, tdecl);
+	}
+	handle_errors(mod->ctx->errors);
+	sources[0] = source;
+
+	obj->otype = target->otype;
+	obj->type = target->type;
+	obj->threadlocal = target->threadlocal;
+}
+
+// Imports an object into a subunit scope. Incomplete declarations of modules
+// loaded from typedefs stay incomplete until they're first looked up, so that
+// only those the unit uses are resolved.
+static void
+import_object(struct scope *scope, struct modcache *mod,
+	const struct scope_object *obj, const struct identifier *ident,
+	const struct identifier *name)
+{
+	if (obj->otype != O_SCAN) {
+		// obj->type and obj->value are a union, so it doesn't matter
+		// which is passed into scope_insert
+		struct scope_object *new = scope_insert(scope, obj->otype,
+			ident, name, obj->type, NULL);
+		new->threadlocal = obj->threadlocal;
+		return;
+	}
+	assert(mod->ctx);
+	struct incomplete_declaration *idecl =
+		xcalloc(1, sizeof(struct incomplete_declaration));
+	scope_object_init(&idecl->obj, O_SCAN, ident, name, NULL, NULL);
+	scope_insert_from_object(scope, &idecl->obj);
+	idecl->type = IDECL_IMPORT;
+	idecl->import = (struct incomplete_import){
+		.module = mod,
+		.object = (struct scope_object *)obj,
+	};
+}
+
 static void
 load_import(struct context *ctx, const struct ast_global_decl *defines,
 	struct ast_imports *import, struct scope *scope)
 {
-	struct scope *mod = module_resolve(ctx, defines, &import->ident);
+	struct modcache *module = module_resolve(ctx, defines, &import->ident);
+	struct scope *mod = module->scope;
 
 	if (import->mode == IMPORT_MEMBERS) {
 		for (const struct ast_import_members *member = import->members;
@@ -4684,13 +4880,8 @@ load_import(struct context *ctx, const struct ast_global_decl *defines,
 				error_norec(ctx, member->loc, "Unknown object '%s'",
 						identifier_unparse(&ident));
 			}
-			assert(obj->otype != O_SCAN);
-			// obj->type and obj->value are a union, so it doesn't
-			// matter which is passed into scope_insert
-			struct scope_object *new = scope_insert(
-					scope, obj->otype, &obj->ident,
-					&name, obj->type, NULL);
-			new->threadlocal = obj->threadlocal;
+			import_object(scope, module, obj, &obj->ident, &name);
+			// Enum types are complete once scanned
 			if (obj->otype != O_TYPE
 					|| type_dealias(ctx, obj->type)->storage
 						!= STORAGE_ENUM) {
@@ -4708,8 +4899,12 @@ load_import(struct context *ctx, const struct ast_global_decl *defines,
 					.name = o->name.name,
 					.ns = &name,
 				};
-				scope_insert(scope, o->otype, &value_ident,
-					&value_name, NULL, o->value);
+				// The enum may belong to another module, so its
+				// values are completed here rather than on lookup
+				wrap_resolver(ctx, (struct scope_object *)o,
+					resolve_enum_field);
+				import_object(scope, module, o,
+					&value_ident, &value_name);
 			}
 		}
 		return;
@@ -4733,15 +4928,9 @@ load_import(struct context *ctx, const struct ast_global_decl *defines,
 
 	for (const struct scope_object *obj = mod->objects;
 			obj; obj = obj->lnext) {
-		assert(obj->otype != O_SCAN);
-
-		struct scope_object *new;
 		if (import->mode == IMPORT_NORMAL) {
-			// obj->type and obj->value are a union, so it doesn't
-			// matter which is passed into scope_insert
-			new = scope_insert(scope, obj->otype, &obj->ident,
-				&obj->name, obj->type, NULL);
-			new->threadlocal = obj->threadlocal;
+			import_object(scope, module, obj,
+				&obj->ident, &obj->name);
 		}
 
 		struct identifier ns, name = {
@@ -4767,11 +4956,7 @@ load_import(struct context *ctx, const struct ast_global_decl *defines,
 			};
 			name.ns = &ns;
 		}
-		// obj->type and obj->value are a union, so it doesn't matter
-		// which is passed into scope_insert
-		new = scope_insert(scope, obj->otype, &obj->ident,
-			&name, obj->type, NULL);
-		new->threadlocal = obj->threadlocal;
+		import_object(scope, module, obj, &obj->ident, &name);
 	}
 }
 
@@ -4789,7 +4974,7 @@ check_internal(type_store *ts,
 	const struct ast_global_decl *defines,
 	const struct ast_unit *aunit,
 	struct unit *unit,
-	bool scan_only)
+	struct context **lazy)
 {
 	struct context ctx = {0};
 	ctx.ns = unit->ns;
@@ -4834,6 +5019,7 @@ check_internal(type_store *ts,
 			su; su = su->next) {
 		su_scope = NULL;
 		scope_push(&su_scope, SCOPE_SUBUNIT);
+		su_scope->resolve = resolve_import;
 		for (struct ast_imports *imports = su->imports;
 				imports; imports = imports->next) {
 			load_import(&ctx, defines, imports, su_scope);
@@ -4893,6 +5079,16 @@ check_internal(type_store *ts,
 		error(&ctx, defineloc, NULL, "Define shadows a non-define object");
 	}
 
+	if (lazy) {
+		// Declarations are resolved when they're first imported, see
+		// resolve_import
+		handle_errors(ctx.errors);
+		*lazy = xcalloc(1, sizeof(struct context));
+		**lazy = ctx;
+		(*lazy)->next = &(*lazy)->errors;
+		return ctx.unit;
+	}
+
 	// Perform actual declaration resolution
 	for (struct scope_object *obj = ctx.unit->objects;
 			obj; obj = obj->lnext) {
@@ -4902,7 +5098,7 @@ check_internal(type_store *ts,
 			(struct incomplete_declaration *)obj;
 		if (idecl->type == IDECL_DECL && idecl->decl.decl_type == ADECL_FUNC) {
 			ctx.unit->parent = idecl->imports;
-			check_function(&ctx, &idecl->obj, &idecl->decl);
+			check_function(&ctx, idecl);
 		}
 	}
 
@@ -4910,7 +5106,7 @@ check_internal(type_store *ts,
 	handle_errors(ctx.errors);
 	unit->declarations = ctx.decls;
 
-	if (!(scan_only || unit->declarations)) {
+	if (!unit->declarations) {
 		xfprintf(stderr, "Error: module contains no declarations\n");
 		exit(EXIT_CHECK);
 	}
@@ -4921,12 +5117,12 @@ check_internal(type_store *ts,
 
 struct scope *
 check(type_store *ts,
+	struct modcache **cache,
 	bool is_test,
 	const char *mainsym,
 	const struct ast_global_decl *defines,
 	const struct ast_unit *aunit,
 	struct unit *unit)
 {
-	struct modcache *modcache[MODCACHE_BUCKETS] = {0};
-	return check_internal(ts, modcache, is_test, mainsym, defines, aunit, unit, false);
+	return check_internal(ts, cache, is_test, mainsym, defines, aunit, unit, NULL);
 }
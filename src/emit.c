@@ -238,27 +238,23 @@ emit_func(const struct qbe_def *def, FILE *out)
 static void
 emit_data_string(const char *str, size_t sz, FILE *out)
 {
-	bool q = false;
+	// Bytes which can't be written as is are escaped in octal, which QBE
+	// passes through to the assembler
+	xfprintf(out, "b \"");
 	for (size_t i = 0; i < sz; ++i) {
-		/* XXX: We could stand to emit less conservatively */
-		if (!isprint((unsigned char)(str[i])) || str[i] == '"'
-				|| str[i] == '\\') {
-			if (q) {
-				q = false;
-				xfprintf(out, "\", ");
-			}
-			xfprintf(out, "b %d%s", str[i], i + 1 < sz ? ", " : "");
+		size_t n = 0;
+		while (i + n < sz && isprint((unsigned char)str[i + n])
+				&& str[i + n] != '"' && str[i + n] != '\\') {
+			++n;
+		}
+		if (n != 0) {
+			xfprintf(out, "%.*s", (int)n, &str[i]);
+			i += n - 1;
 		} else {
-			if (!q) {
-				q = true;
-				xfprintf(out, "b \"");
-			}
-			xfprintf(out, "%c", str[i]);
+			xfprintf(out, "\\%03o", (unsigned char)str[i]);
 		}
 	}
-	if (q) {
-		xfprintf(out, "\"");
-	}
+	xfprintf(out, "\"");
 }
 
 static bool
@@ -303,6 +299,18 @@ is_zeroes(const struct qbe_data_item *data)
 	return true;
 }
 
+static bool
+has_globals(const struct qbe_data_item *data)
+{
+	for (const struct qbe_data_item *cur = data; cur; cur = cur->next) {
+		if (cur->type == QD_SYMOFFS || (cur->type == QD_VALUE
+				&& cur->value.kind == QV_GLOBAL)) {
+			return true;
+		}
+	}
+	return false;
+}
+
 static void
 emit_data(const struct qbe_def *def, FILE *out)
 {
@@ -318,6 +326,12 @@ emit_data(const struct qbe_def *def, FILE *out)
 		} else {
 			xfprintf(out, "section \".tdata\" \"awT\"");
 		}
+	} else if (def->data.readonly && has_globals(&def->data.items)) {
+		// Relocated at load time, then read-only if the linker supports
+		// RELRO
+		xfprintf(out, "section \".data.rel.ro.%s\" \"aw\"", def->name);
+	} else if (def->data.readonly) {
+		xfprintf(out, "section \".rodata.%s\" \"a\"", def->name);
 	} else if (is_zeroes(&def->data.items)) {
 		xfprintf(out, "section \".bss.%s\"", def->name);
 	} else {
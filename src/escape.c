@@ -0,0 +1,313 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include "check.h"
+#include "expr.h"
+#include "opt.h"
+#include "scope.h"
+#include "types.h"
+#include "util.h"
+
+// Escape analysis for alloc
+//
+// A binding initialized with alloc, whose pointer or slice is never used
+// except to read or write through it, take its length, or free it, cannot
+// outlive the function, so its memory is taken from the stack rather than the
+// heap and its frees are dropped. Any other use of the binding, or taking the
+// address of (or slicing) anything reached through it, is an escape. Aggregate
+// values read through the binding are copied by their consumers, so they don't
+// escape.
+//
+// Gen reserves one stack slot for each such allocation in the function prelude,
+// so only allocations whose size is known and small are considered.
+
+// Maximum size of a single allocation moved to the stack
+#define STACK_ALLOC_MAX 4096
+
+// Maximum total size of the allocations moved to the stack in one function
+#define STACK_ALLOC_BUDGET 32768
+
+struct escape_candidate {
+	const struct scope_object *object;
+	struct expression *alloc;
+	size_t size;
+	bool escapes;
+	struct escape_candidate *next;
+};
+
+struct escape_state {
+	struct escape_candidate *cands;
+};
+
+static struct escape_candidate *
+lookup_candidate(struct escape_state *state, const struct expression *expr)
+{
+	if (expr->type != EXPR_ACCESS
+			|| expr->access.type != ACCESS_IDENTIFIER) {
+		return NULL;
+	}
+	for (struct escape_candidate *cand = state->cands;
+			cand; cand = cand->next) {
+		if (cand->object == expr->access.object) {
+			return cand;
+		}
+	}
+	return NULL;
+}
+
+// Returns the size of the memory returned by an alloc expression, or zero if
+// it isn't known at compile time.
+static size_t
+alloc_size(const struct expression *expr)
+{
+	const struct type *result = type_dealias(NULL, expr->result);
+	const struct type *init = type_dealias(NULL, expr->alloc.init->result);
+	size_t length;
+	switch (expr->alloc.kind) {
+	case ALLOC_OBJECT:
+		if (result->storage != STORAGE_POINTER) {
+			return 0;
+		}
+		return result->pointer.referent->size;
+	case ALLOC_WITH_CAP:
+	case ALLOC_WITH_LEN:
+		if (init->storage != STORAGE_ARRAY
+				|| expr->alloc.cap->type != EXPR_LITERAL) {
+			return 0;
+		}
+		length = expr->alloc.cap->literal.uval;
+		break;
+	case ALLOC_COPY:
+		if (init->storage != STORAGE_ARRAY) {
+			return 0;
+		}
+		length = init->array.length;
+		break;
+	default:
+		abort(); // Unreachable
+	}
+	assert(result->storage == STORAGE_SLICE);
+	size_t membsz = result->array.members->size;
+	if (length > STACK_ALLOC_MAX / membsz) {
+		return 0;
+	}
+	return length * membsz;
+}
+
+static bool
+collect_candidates(struct expression **slot, void *user)
+{
+	struct escape_state *state = user;
+	const struct expression *expr = *slot;
+	if (expr->type != EXPR_BINDING) {
+		return true;
+	}
+	for (const struct expression_binding *binding = &expr->binding;
+			binding; binding = binding->next) {
+		struct expression *init = binding->initializer;
+		if (binding->unpack || !binding->object
+				|| binding->object->otype != O_BIND
+				|| init->type != EXPR_ALLOC) {
+			continue;
+		}
+		size_t size = alloc_size(init);
+		if (size == 0 || size == SIZE_UNDEFINED
+				|| size > STACK_ALLOC_MAX) {
+			continue;
+		}
+		struct escape_candidate *cand =
+			xcalloc(1, sizeof(struct escape_candidate));
+		cand->object = binding->object;
+		cand->alloc = init;
+		cand->size = size;
+		cand->next = state->cands;
+		state->cands = cand;
+	}
+	return true;
+}
+
+// Returns the candidate whose memory expr refers to, if it is reached through
+// one by way of field, index, or tuple accesses, dereferences, and casts.
+static struct escape_candidate *
+referenced_candidate(struct escape_state *state, const struct expression *expr)
+{
+	while (true) {
+		switch (expr->type) {
+		case EXPR_ACCESS:
+			switch (expr->access.type) {
+			case ACCESS_IDENTIFIER:
+				return lookup_candidate(state, expr);
+			case ACCESS_INDEX:
+				expr = expr->access.array;
+				break;
+			case ACCESS_FIELD:
+				expr = expr->access._struct;
+				break;
+			case ACCESS_TUPLE:
+				expr = expr->access.tuple;
+				break;
+			}
+			break;
+		case EXPR_CAST:
+			expr = expr->cast.value;
+			break;
+		case EXPR_UNARITHM:
+			if (expr->unarithm.op != UN_DEREF) {
+				return NULL;
+			}
+			expr = expr->unarithm.operand;
+			break;
+		default:
+			return NULL;
+		}
+	}
+}
+
+static void
+mark_escape(struct escape_state *state, const struct expression *expr)
+{
+	struct escape_candidate *cand = referenced_candidate(state, expr);
+	if (cand) {
+		cand->escapes = true;
+	}
+}
+
+static bool
+find_escapes(struct expression **slot, void *user)
+{
+	struct escape_state *state = user;
+	struct expression *expr = *slot;
+	struct escape_candidate *cand = lookup_candidate(state, expr);
+	if (cand) {
+		// The pointer or slice itself is used as a value
+		cand->escapes = true;
+		return false;
+	}
+
+	switch (expr->type) {
+	case EXPR_ACCESS:
+		switch (expr->access.type) {
+		case ACCESS_IDENTIFIER:
+			break;
+		case ACCESS_INDEX:
+			if (lookup_candidate(state, expr->access.array)) {
+				if (find_escapes(&expr->access.index, state)) {
+					expr_walk(expr->access.index,
+						find_escapes, state);
+				}
+				return false;
+			}
+			break;
+		case ACCESS_FIELD:
+			if (lookup_candidate(state, expr->access._struct)) {
+				return false;
+			}
+			break;
+		case ACCESS_TUPLE:
+			if (lookup_candidate(state, expr->access.tuple)) {
+				return false;
+			}
+			break;
+		}
+		break;
+	case EXPR_APPEND:
+	case EXPR_INSERT:
+		mark_escape(state, expr->append.object);
+		break;
+	case EXPR_CAST:;
+		const struct type *to = type_dealias(NULL, expr->result);
+		if (to->storage == STORAGE_SLICE
+				|| to->storage == STORAGE_POINTER) {
+			mark_escape(state, expr->cast.value);
+		}
+		break;
+	case EXPR_DELETE:
+		mark_escape(state, expr->delete.expr);
+		break;
+	case EXPR_FREE:
+	case EXPR_LEN:;
+		struct expression *value = expr->type == EXPR_FREE
+			? expr->free.expr : expr->len.value;
+		if (lookup_candidate(state, value)) {
+			return false;
+		}
+		break;
+	case EXPR_SLICE:
+		mark_escape(state, expr->slice.object);
+		break;
+	case EXPR_UNARITHM:
+		switch (expr->unarithm.op) {
+		case UN_ADDRESS:
+			mark_escape(state, expr->unarithm.operand);
+			break;
+		case UN_DEREF:
+			if (lookup_candidate(state, expr->unarithm.operand)) {
+				return false;
+			}
+			break;
+		default:
+			break;
+		}
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+static bool
+drop_frees(struct expression **slot, void *user)
+{
+	struct escape_state *state = user;
+	struct expression *expr = *slot;
+	if (expr->type != EXPR_FREE) {
+		return true;
+	}
+	struct escape_candidate *cand = lookup_candidate(state, expr->free.expr);
+	if (cand && !cand->escapes) {
+		struct expression *out = xcalloc(1, sizeof(struct expression));
+		out->type = EXPR_LITERAL;
+		out->loc = expr->loc;
+		out->result = expr->result;
+		*slot = out;
+	}
+	return false;
+}
+
+void
+opt_escape(struct declaration *decl)
+{
+	struct escape_state state = {0};
+	expr_walk(decl->func.body, collect_candidates, &state);
+	if (!state.cands) {
+		return;
+	}
+
+	struct expression *body = decl->func.body;
+	if (find_escapes(&body, &state)) {
+		expr_walk(body, find_escapes, &state);
+	}
+
+	size_t budget = STACK_ALLOC_BUDGET;
+	bool any = false;
+	for (struct escape_candidate *cand = state.cands;
+			cand; cand = cand->next) {
+		if (cand->escapes || cand->size > budget) {
+			cand->escapes = true;
+			continue;
+		}
+		budget -= cand->size;
+		cand->alloc->alloc.stack = true;
+		any = true;
+	}
+	if (any) {
+		expr_walk(body, drop_frees, &state);
+	}
+
+	while (state.cands) {
+		struct escape_candidate *next = state.cands->next;
+		free(state.cands);
+		state.cands = next;
+	}
+}
@@ -12,11 +12,276 @@
 #include "types.h"
 #include "util.h"
 
+// Initializers which must be constant may call functions defined in this unit.
+// Such calls are run here, over the checked body of the callee, with locals
+// kept as literals in a list of bindings for each call. Anything which has an
+// effect outside of the call (allocations, pointers, globals, defers, and calls
+// to functions with no body here) fails to evaluate, as does a call which runs
+// for too long. Locals are only ever written through bindings, arrays, structs,
+// and tuples, and arrays are only sliced to be passed as arguments, so a value
+// is never shared by two locals. Locals keep the members of each array in one
+// block, which is indexed by position.
+
+// Maximum number of expressions evaluated within calls and loop iterations run
+// for one initializer. Literals don't count, however large, nor do the copies
+// of values made when they're stored in locals.
+#define EVAL_STEP_BUDGET 1000000
+
+// Maximum depth of nested calls
+#define EVAL_CALL_DEPTH 256
+
+enum eval_exit {
+	EXIT_NONE,
+	EXIT_BREAK,
+	EXIT_CONTINUE,
+	EXIT_RETURN,
+	EXIT_YIELD,
+};
+
+struct eval_binding {
+	const struct scope_object *object;
+	struct expression value;
+	struct eval_binding *next;
+};
+
+struct eval_state {
+	struct eval_binding *bindings; // Locals of the current call
+	size_t steps, depth;
+	struct location call; // Of the innermost call, for errors
+	bool store; // Set while eval_store copies a value
+
+	// Set by break, continue, return, and yield until the expression they
+	// leave is reached
+	enum eval_exit exit;
+	const struct scope *target;
+	struct expression value;
+};
+
+static bool
+eval_step(struct context *ctx, const struct expression *in)
+{
+	struct eval_state *state = ctx->eval;
+	if (++state->steps > EVAL_STEP_BUDGET) {
+		// Expressions made up by eval have no location of their own
+		struct location loc = state->depth > 0 ? state->call : in->loc;
+		if (state->steps == EVAL_STEP_BUDGET + 1) {
+			error(ctx, loc, NULL, "evaluation exceeded %d steps",
+				EVAL_STEP_BUDGET);
+		}
+		return false;
+	}
+	return true;
+}
+
+static struct expression *
+lookup_local(struct eval_state *state, const struct scope_object *obj)
+{
+	for (struct eval_binding *b = state->bindings; b; b = b->next) {
+		if (b->object == obj) {
+			return &b->value;
+		}
+	}
+	return NULL;
+}
+
+// Returns true if expr refers to a local binding, or to an element or field of
+// one. Writes can't go through slices, which may be shared.
+static bool
+is_local_place(struct context *ctx, const struct expression *expr, bool write)
+{
+	while (expr->type == EXPR_ACCESS) {
+		const struct expression *object;
+		switch (expr->access.type) {
+		case ACCESS_IDENTIFIER:
+			return expr->access.object->otype == O_BIND;
+		case ACCESS_INDEX:
+			object = expr->access.array;
+			break;
+		case ACCESS_FIELD:
+			object = expr->access._struct;
+			break;
+		case ACCESS_TUPLE:
+			object = expr->access.tuple;
+			break;
+		default:
+			abort(); // Invariant
+		}
+		enum type_storage storage =
+			type_dealias(ctx, object->result)->storage;
+		if (storage == STORAGE_POINTER
+				|| (write && storage == STORAGE_SLICE)) {
+			return false;
+		}
+		expr = object;
+	}
+	return false;
+}
+
+// Stores member i of a packed array of integers in out
+static void
+packed_member(struct context *ctx, const struct type *type,
+	const struct packed_literal *packed, size_t i, struct expression *out)
+{
+	const struct type *membtype = type_dealias(ctx, type)->array.members;
+	assert(type_is_integer(ctx, membtype));
+	const unsigned char *data =
+		(const unsigned char *)packed->data + i * membtype->size;
+	uint64_t val = 0;
+	for (size_t j = membtype->size; j > 0; --j) {
+		val = val << 8 | data[j - 1];
+	}
+	size_t bits = membtype->size * 8;
+	if (type_is_signed(ctx, membtype) && bits < 64
+			&& (val >> (bits - 1) & 1)) {
+		val |= UINT64_MAX << bits;
+	}
+	out->type = EXPR_LITERAL;
+	out->result = membtype;
+	out->literal = (struct expression_literal){ .uval = val };
+}
+
+// Returns the number of members of an array or slice value
+static size_t
+array_length(struct context *ctx, const struct expression *value)
+{
+	const struct type *type = type_dealias(ctx, value->result);
+	if (type->storage == STORAGE_ARRAY && !type->array.expandable) {
+		return type->array.length;
+	} else if (value->literal.packed) {
+		return value->literal.packed->len / type->array.members->size;
+	}
+	size_t n = 0;
+	for (const struct array_literal *item = value->literal.array;
+			item; item = item->next) {
+		++n;
+	}
+	return n;
+}
+
+// Stores copies of the members of an array or slice in out as one block, so
+// that they can be indexed by position. Packed arrays are unpacked. If expand is
+// set, arrays which list fewer members than their length, such as those filled
+// by literal_default, repeat the last one. array and out may be the same.
+static bool
+array_members(struct context *ctx,
+	const struct expression *array,
+	struct expression *out,
+	bool expand)
+{
+	const struct packed_literal *packed = array->literal.packed;
+	const struct array_literal *item = array->literal.array;
+	size_t length = 0;
+	if (expand || packed) {
+		length = array_length(ctx, array);
+	} else {
+		for (; item; item = item->next) {
+			++length;
+		}
+		item = array->literal.array;
+	}
+	struct array_literal *members =
+		xcalloc(length, sizeof(struct array_literal));
+	for (size_t i = 0; i < length; ++i) {
+		members[i].value = xcalloc(1, sizeof(struct expression));
+		members[i].next = i + 1 < length ? &members[i + 1] : NULL;
+		if (packed) {
+			packed_member(ctx, array->result, packed, i,
+				members[i].value);
+			continue;
+		}
+		if (!eval_expr(ctx, item->value, members[i].value)) {
+			return false;
+		}
+		if (item->next) {
+			item = item->next;
+		}
+	}
+	out->literal.packed = NULL;
+	out->literal.array = length != 0 ? members : NULL;
+	return true;
+}
+
+// Returns the value stored in the place expr refers to, which must satisfy
+// is_local_place, or NULL if it can't be found.
+static struct expression *
+eval_place(struct context *ctx, const struct expression *expr)
+{
+	struct expression *object;
+	struct expression index = {0};
+	switch (expr->access.type) {
+	case ACCESS_IDENTIFIER:
+		return lookup_local(ctx->eval, expr->access.object);
+	case ACCESS_INDEX:
+		object = eval_place(ctx, expr->access.array);
+		if (!object || !eval_expr(ctx, expr->access.index, &index)) {
+			return NULL;
+		}
+		if (index.literal.uval >= array_length(ctx, object)) {
+			error(ctx, expr->loc, NULL,
+				"slice or array access out of bounds");
+			return NULL;
+		}
+		if (object->literal.packed
+				&& !array_members(ctx, object, object, true)) {
+			return NULL;
+		}
+		// Expanded into one block by eval_store
+		return object->literal.array[index.literal.uval].value;
+	case ACCESS_FIELD:
+		object = eval_place(ctx, expr->access._struct);
+		if (!object) {
+			return NULL;
+		}
+		for (struct struct_literal *field = object->literal._struct;
+				field; field = field->next) {
+			if (!strcmp(field->field->name,
+					expr->access.field->name)) {
+				return field->value;
+			}
+		}
+		return NULL;
+	case ACCESS_TUPLE:
+		object = eval_place(ctx, expr->access.tuple);
+		if (!object) {
+			return NULL;
+		}
+		struct tuple_literal *value = object->literal.tuple;
+		for (size_t i = expr->access.tindex; value && i > 0; --i) {
+			value = value->next;
+		}
+		return value ? value->value : NULL;
+	}
+	abort(); // Unreachable
+}
+
 static bool
 eval_access(struct context *ctx,
 	const struct expression *in,
 	struct expression *out)
 {
+	if (ctx->eval && is_local_place(ctx, in, false)) {
+		const struct expression *value = eval_place(ctx, in);
+		return value && eval_expr(ctx, value, out);
+	}
+	const struct expression *object = NULL;
+	switch (in->access.type) {
+	case ACCESS_IDENTIFIER:
+		break;
+	case ACCESS_INDEX:
+		object = in->access.array;
+		break;
+	case ACCESS_FIELD:
+		object = in->access._struct;
+		break;
+	case ACCESS_TUPLE:
+		object = in->access.tuple;
+		break;
+	}
+	if (object && type_dealias(ctx,
+			object->result)->storage == STORAGE_POINTER) {
+		return false; // Auto-dereference
+	}
+
 	struct expression tmp = {0};
 	switch (in->access.type) {
 	case ACCESS_IDENTIFIER:
@@ -25,16 +290,26 @@ eval_access(struct context *ctx,
 		if (!eval_expr(ctx, in->access.array, &tmp)) {
 			return false;
 		}
+		const struct type *atype = tmp.result;
+		const struct packed_literal *packed = tmp.literal.packed;
 		const struct array_literal *array = tmp.literal.array;
+		size_t length = array_length(ctx, &tmp);
 		if (!eval_expr(ctx, in->access.index, &tmp)) {
 			return false;
 		}
-		for (size_t i = tmp.literal.uval; i > 0; --i) {
-			if (array == NULL) {
-				error(ctx, in->loc, NULL,
-					"slice or array access out of bounds");
-				return false;
-			}
+		if (tmp.literal.uval >= length) {
+			error(ctx, in->loc, NULL,
+				"slice or array access out of bounds");
+			return false;
+		}
+		if (packed) {
+			packed_member(ctx, atype, packed, tmp.literal.uval, out);
+			out->result = in->result;
+			return true;
+		}
+		// Arrays listing fewer members than their length repeat the
+		// last one
+		for (size_t i = tmp.literal.uval; i > 0 && array->next; --i) {
 			array = array->next;
 		}
 		return eval_expr(ctx, array->value, out);
@@ -150,6 +425,11 @@ eval_binarithm(struct context *ctx,
 	if (!eval_expr(ctx, in->binarithm.lvalue, &lvalue)) {
 		return false;
 	}
+	if ((in->binarithm.op == BIN_LAND && !lvalue.literal.bval)
+			|| (in->binarithm.op == BIN_LOR && lvalue.literal.bval)) {
+		out->literal.bval = lvalue.literal.bval;
+		return true;
+	}
 	if (!eval_expr(ctx, in->binarithm.rvalue, &rvalue)) {
 		return false;
 	}
@@ -408,19 +688,15 @@ eval_literal(struct context *ctx,
 	case STORAGE_ALIAS:
 	case STORAGE_ENUM:
 		assert(0); // Handled above
-	case STORAGE_ARRAY:;
-		struct array_literal **anext = &out->literal.array;
-		for (struct array_literal *arr = in->literal.array; arr;
-				arr = arr->next) {
-			struct array_literal *alit = *anext =
-				xcalloc(1, sizeof(struct array_literal));
-			alit->value = xcalloc(1, sizeof(struct expression));
-			if (!eval_expr(ctx, arr->value, alit->value)) {
-				return false;
-			}
-			anext = &alit->next;
+	case STORAGE_ARRAY:
+	case STORAGE_SLICE:;
+		if (in->literal.packed) {
+			// Never written to in place, see eval_place
+			out->literal.packed = in->literal.packed;
+			break;
 		}
-		break;
+		return array_members(ctx, in, out,
+			ctx->eval && ctx->eval->store);
 	case STORAGE_STRING:
 		out->literal.string.len = in->literal.string.len;
 		out->literal.string.value = xcalloc(1, in->literal.string.len);
@@ -491,7 +767,6 @@ eval_literal(struct context *ctx,
 	case STORAGE_FUNCTION:
 	case STORAGE_NEVER:
 	case STORAGE_OPAQUE:
-	case STORAGE_SLICE:
 	case STORAGE_VALIST:
 		abort(); // Invariant
 	}
@@ -562,6 +837,13 @@ eval_cast(struct context *ctx,
 	const struct expression *in,
 	struct expression *out)
 {
+	if (ctx->eval && type_dealias(ctx, in->result)->storage == STORAGE_SLICE
+			&& type_dealias(ctx, in->cast.value->result)->storage
+				== STORAGE_ARRAY
+			&& is_local_place(ctx, in->cast.value, false)) {
+		return false; // The slice would share the binding's value
+	}
+
 	struct expression val = {0};
 	if (!eval_expr(ctx, in->cast.value, &val)) {
 		return false;
@@ -692,7 +974,13 @@ eval_len(struct context *ctx,
 	}
 
 	struct expression obj = {0};
-	if (!eval_expr(ctx, in->len.value, &obj)) {
+	if (ctx->eval && is_local_place(ctx, in->len.value, false)) {
+		const struct expression *value = eval_place(ctx, in->len.value);
+		if (!value) {
+			return false;
+		}
+		obj = *value;
+	} else if (!eval_expr(ctx, in->len.value, &obj)) {
 		return false;
 	}
 
@@ -710,12 +998,7 @@ eval_len(struct context *ctx,
 		abort(); // Invariant
 	}
 
-	uint64_t len = 0;
-	for (struct array_literal *c = obj.literal.array;
-			c != NULL; c = c->next) {
-		len++;
-	}
-	out->literal.uval = len;
+	out->literal.uval = array_length(ctx, &obj);
 	return true;
 }
 
@@ -1025,6 +1308,452 @@ eval_unarithm(struct context *ctx,
 	return true;
 }
 
+// Stores a copy of value in place, so that none of it is shared, with the
+// members of each array expanded into one block; see array_members
+static bool
+eval_store(struct context *ctx,
+	const struct expression *value,
+	struct expression *place)
+{
+	struct eval_state *state = ctx->eval;
+	struct expression copy = {0};
+	state->store = true;
+	bool ok = eval_expr(ctx, value, &copy);
+	state->store = false;
+	if (!ok) {
+		return false;
+	}
+	*place = copy;
+	return true;
+}
+
+static bool
+eval_assign(struct context *ctx,
+	const struct expression *in,
+	struct expression *out)
+{
+	struct eval_state *state = ctx->eval;
+	struct expression *object = in->assign.object;
+	if (!is_local_place(ctx, object, true)) {
+		return false;
+	}
+	struct expression *place = eval_place(ctx, object);
+	if (!place) {
+		return false;
+	}
+
+	struct expression value = {0};
+	if (in->assign.op == BIN_LEQUAL) {
+		if (!eval_expr(ctx, in->assign.value, &value)) {
+			return false;
+		}
+	} else {
+		struct expression binarithm = {
+			.type = EXPR_BINARITHM,
+			.result = object->result,
+			.loc = in->loc,
+			.binarithm = {
+				.op = in->assign.op,
+				.lvalue = place,
+				.rvalue = in->assign.value,
+			},
+		};
+		if (!eval_expr(ctx, &binarithm, &value)) {
+			return false;
+		}
+	}
+	if (state->exit != EXIT_NONE) {
+		return true;
+	}
+	return eval_store(ctx, &value, place);
+}
+
+static bool
+eval_binding(struct context *ctx,
+	const struct expression *in,
+	struct expression *out)
+{
+	struct eval_state *state = ctx->eval;
+	if (in->type == EXPR_DEFINE) {
+		return true; // Already substituted by check
+	}
+	for (const struct expression_binding *binding = &in->binding;
+			binding; binding = binding->next) {
+		if (binding->unpack || binding->object->otype != O_BIND) {
+			return false;
+		}
+		struct expression value = {0};
+		if (!eval_expr(ctx, binding->initializer, &value)) {
+			return false;
+		}
+		if (state->exit != EXIT_NONE) {
+			return true;
+		}
+		// A binding in a loop is stored over its previous value
+		struct expression *place = lookup_local(state, binding->object);
+		if (!place) {
+			struct eval_binding *local =
+				xcalloc(1, sizeof(struct eval_binding));
+			local->object = binding->object;
+			local->next = state->bindings;
+			state->bindings = local;
+			place = &local->value;
+		}
+		if (!eval_store(ctx, &value, place)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool
+eval_compound(struct context *ctx,
+	const struct expression *in,
+	struct expression *out)
+{
+	struct eval_state *state = ctx->eval;
+	for (const struct expressions *exprs = &in->compound.exprs;
+			exprs; exprs = exprs->next) {
+		if (!eval_expr(ctx, exprs->expr, out)) {
+			return false;
+		}
+		if (state->exit != EXIT_NONE) {
+			break;
+		}
+	}
+	if (state->exit == EXIT_YIELD
+			&& state->target == in->compound.scope) {
+		state->exit = EXIT_NONE;
+		*out = state->value;
+	}
+	out->result = in->result;
+	return true;
+}
+
+static bool
+eval_control(struct context *ctx,
+	const struct expression *in,
+	struct expression *out)
+{
+	struct eval_state *state = ctx->eval;
+	struct expression value = {
+		.type = EXPR_LITERAL,
+		.result = &builtin_type_void,
+	};
+	const struct expression *from = NULL;
+	enum eval_exit exit;
+	switch (in->type) {
+	case EXPR_BREAK:
+		exit = EXIT_BREAK;
+		break;
+	case EXPR_CONTINUE:
+		exit = EXIT_CONTINUE;
+		break;
+	case EXPR_RETURN:
+		exit = EXIT_RETURN;
+		from = in->_return.value;
+		break;
+	case EXPR_YIELD:
+		exit = EXIT_YIELD;
+		from = in->control.value;
+		break;
+	default:
+		abort(); // Invariant
+	}
+	if (from) {
+		if (!eval_expr(ctx, from, &value)) {
+			return false;
+		}
+		if (state->exit != EXIT_NONE) {
+			return true;
+		}
+	}
+	state->exit = exit;
+	state->target = exit == EXIT_RETURN ? NULL : in->control.scope;
+	state->value = value;
+	return true;
+}
+
+static bool
+eval_for(struct context *ctx,
+	const struct expression *in,
+	struct expression *out)
+{
+	struct eval_state *state = ctx->eval;
+	struct expression tmp = {0};
+	if (in->_for.bindings) {
+		if (!eval_expr(ctx, in->_for.bindings, &tmp)) {
+			return false;
+		}
+		if (state->exit != EXIT_NONE) {
+			return true;
+		}
+	}
+
+	while (true) {
+		if (!eval_step(ctx, in)) {
+			return false;
+		}
+		struct expression cond = {0};
+		if (!eval_expr(ctx, in->_for.cond, &cond)) {
+			return false;
+		}
+		if (state->exit != EXIT_NONE) {
+			return true;
+		}
+		if (!cond.literal.bval) {
+			break;
+		}
+
+		if (!eval_expr(ctx, in->_for.body, &tmp)) {
+			return false;
+		}
+		if (state->exit != EXIT_NONE) {
+			if (state->target != in->_for.scope) {
+				return true;
+			}
+			enum eval_exit exit = state->exit;
+			state->exit = EXIT_NONE;
+			if (exit == EXIT_BREAK) {
+				break;
+			}
+		}
+
+		if (in->_for.afterthought) {
+			if (!eval_expr(ctx, in->_for.afterthought, &tmp)) {
+				return false;
+			}
+			if (state->exit != EXIT_NONE) {
+				return true;
+			}
+		}
+	}
+	return true;
+}
+
+static bool
+eval_if(struct context *ctx,
+	const struct expression *in,
+	struct expression *out)
+{
+	struct expression cond = {0};
+	if (!eval_expr(ctx, in->_if.cond, &cond)) {
+		return false;
+	}
+	if (ctx->eval->exit != EXIT_NONE) {
+		return true;
+	}
+	const struct expression *branch = cond.literal.bval
+		? in->_if.true_branch : in->_if.false_branch;
+	if (!branch) {
+		return true;
+	}
+	return eval_expr(ctx, branch, out);
+}
+
+static bool
+eval_switch(struct context *ctx,
+	const struct expression *in,
+	struct expression *out)
+{
+	struct expression value = {0};
+	if (!eval_expr(ctx, in->_switch.value, &value)) {
+		return false;
+	}
+	if (ctx->eval->exit != EXIT_NONE) {
+		return true;
+	}
+
+	const struct switch_case *match = NULL;
+	for (const struct switch_case *_case = in->_switch.cases;
+			_case && !match; _case = _case->next) {
+		if (!_case->options) {
+			continue;
+		}
+		for (const struct case_option *opt = _case->options;
+				opt; opt = opt->next) {
+			struct expression compare = {
+				.type = EXPR_BINARITHM,
+				.result = &builtin_type_bool,
+				.loc = in->loc,
+				.binarithm = {
+					.op = BIN_LEQUAL,
+					.lvalue = &value,
+					.rvalue = opt->value,
+				},
+			}, equal = {0};
+			if (!eval_expr(ctx, &compare, &equal)) {
+				return false;
+			}
+			if (equal.literal.bval) {
+				match = _case;
+				break;
+			}
+		}
+	}
+	for (const struct switch_case *_case = in->_switch.cases;
+			_case && !match; _case = _case->next) {
+		if (!_case->options) {
+			match = _case;
+		}
+	}
+	if (!match || !eval_expr(ctx, match->value, out)) {
+		return false;
+	}
+	// Gen doesn't convert the result of each case to the result of the
+	// switch, so neither do we
+	return ctx->eval->exit != EXIT_NONE || out->result == in->result;
+}
+
+static bool
+eval_assert(struct context *ctx,
+	const struct expression *in,
+	struct expression *out)
+{
+	if (!in->assert.cond) {
+		return false; // abort()
+	}
+	struct expression cond = {0};
+	if (!eval_expr(ctx, in->assert.cond, &cond)) {
+		return false;
+	}
+	return ctx->eval->exit != EXIT_NONE || cond.literal.bval;
+}
+
+// Returns true if values of the given type may refer to other values
+static bool
+holds_reference(struct context *ctx, const struct type *type)
+{
+	type = type_dealias(ctx, type);
+	switch (type->storage) {
+	case STORAGE_POINTER:
+	case STORAGE_SLICE:
+		return true;
+	case STORAGE_ARRAY:
+		return holds_reference(ctx, type->array.members);
+	case STORAGE_STRUCT:
+	case STORAGE_UNION:
+		for (const struct struct_field *field = type->struct_union.fields;
+				field; field = field->next) {
+			if (holds_reference(ctx, field->type)) {
+				return true;
+			}
+		}
+		return false;
+	case STORAGE_TAGGED:
+		for (const struct type_tagged_union *tu = &type->tagged;
+				tu; tu = tu->next) {
+			if (holds_reference(ctx, tu->type)) {
+				return true;
+			}
+		}
+		return false;
+	case STORAGE_TUPLE:
+		for (const struct type_tuple *tuple = &type->tuple;
+				tuple; tuple = tuple->next) {
+			if (holds_reference(ctx, tuple->type)) {
+				return true;
+			}
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+static bool
+eval_call(struct context *ctx,
+	const struct expression *in,
+	struct expression *out)
+{
+	struct eval_state *state = ctx->eval;
+	const struct expression *lvalue = in->call.lvalue;
+	if (lvalue->type != EXPR_ACCESS
+			|| lvalue->access.type != ACCESS_IDENTIFIER
+			|| lvalue->access.object->otype != O_DECL) {
+		return false;
+	}
+	const struct type *fntype = type_dealias(ctx, lvalue->result);
+	if (fntype->storage != STORAGE_FUNCTION
+			|| fntype->func.variadism != VARIADISM_NONE) {
+		return false;
+	}
+	const struct declaration *decl =
+		lookup_function(ctx, lvalue->access.object);
+	if (!decl || !decl->func.body) {
+		return false;
+	}
+	if (state->depth == EVAL_CALL_DEPTH) {
+		error(ctx, in->loc, NULL,
+			"evaluation exceeded %d nested calls", EVAL_CALL_DEPTH);
+		return false;
+	}
+
+	// Arguments are evaluated by the caller. An array passed as a slice
+	// is shared with the callee, which can't write through it, but could
+	// return it.
+	struct eval_binding *params = NULL;
+	bool shared = false;
+	const struct call_argument *arg = in->call.args;
+	for (const struct scope_object *param = decl->func.scope->objects;
+			param; param = param->lnext, arg = arg->next) {
+		struct eval_binding *local =
+			xcalloc(1, sizeof(struct eval_binding));
+		local->object = param;
+		local->next = params;
+		params = local;
+
+		const struct expression *value = arg->value;
+		if (value->type == EXPR_CAST && value->cast.kind == C_CAST
+				&& type_dealias(ctx, value->result)->storage
+					== STORAGE_SLICE
+				&& type_dealias(ctx, value->cast.value->result)->storage
+					== STORAGE_ARRAY
+				&& is_local_place(ctx, value->cast.value, false)) {
+			const struct expression *array =
+				eval_place(ctx, value->cast.value);
+			if (!array) {
+				return false;
+			}
+			// Keeps the array's type, which gives its length
+			local->value = *array;
+			shared = true;
+			continue;
+		}
+		struct expression val = {0};
+		if (!eval_expr(ctx, value, &val)) {
+			return false;
+		} else if (state->exit != EXIT_NONE) {
+			return true;
+		} else if (!eval_store(ctx, &val, &local->value)) {
+			return false;
+		}
+	}
+	if (shared && holds_reference(ctx, fntype->func.result)) {
+		return false;
+	}
+
+	struct eval_binding *bindings = state->bindings;
+	struct location call = state->call;
+	state->bindings = params;
+	state->call = in->loc;
+	++state->depth;
+	bool ok = eval_expr(ctx, decl->func.body, out);
+	--state->depth;
+	state->bindings = bindings;
+	state->call = call;
+	if (!ok) {
+		return false;
+	}
+	if (state->exit == EXIT_RETURN) {
+		state->exit = EXIT_NONE;
+		*out = state->value;
+	}
+	assert(state->exit == EXIT_NONE);
+	out->result = in->result;
+	return true;
+}
+
 bool
 eval_expr(struct context *ctx,
 	const struct expression *in,
@@ -1033,6 +1762,15 @@ eval_expr(struct context *ctx,
 	out->result = in->result;
 	out->type = EXPR_LITERAL;
 
+	struct eval_state *state = ctx->eval;
+	if (state && state->exit != EXIT_NONE) {
+		return false; // Left in the middle of an expression
+	}
+	if (state && state->depth > 0 && in->type != EXPR_LITERAL
+			&& !eval_step(ctx, in)) {
+		return false;
+	}
+
 	switch (in->type) {
 	case EXPR_ACCESS:
 		return eval_access(ctx, in, out);
@@ -1056,36 +1794,60 @@ eval_expr(struct context *ctx,
 	case EXPR_STRUCT:
 		return eval_struct(ctx, in, out);
 	case EXPR_SLICE:
+		if (state) {
+			return false;
+		}
 		assert(0); // TODO
 	case EXPR_TUPLE:
 		return eval_tuple(ctx, in, out);
 	case EXPR_UNARITHM:
 		return eval_unarithm(ctx, in, out);
-	case EXPR_ALLOC:
-	case EXPR_APPEND:
 	case EXPR_ASSERT:
+		return state && eval_assert(ctx, in, out);
 	case EXPR_ASSIGN:
+		return state && eval_assign(ctx, in, out);
 	case EXPR_BINDING:
+	case EXPR_DEFINE:
+		return state && eval_binding(ctx, in, out);
 	case EXPR_BREAK:
+	case EXPR_CONTINUE:
+	case EXPR_RETURN:
+	case EXPR_YIELD:
+		return state && eval_control(ctx, in, out);
 	case EXPR_CALL:
+		return state && eval_call(ctx, in, out);
 	case EXPR_COMPOUND:
-	case EXPR_CONTINUE:
+		return state && eval_compound(ctx, in, out);
+	case EXPR_FOR:
+		return state && eval_for(ctx, in, out);
+	case EXPR_IF:
+		return state && eval_if(ctx, in, out);
+	case EXPR_SWITCH:
+		return state && eval_switch(ctx, in, out);
+	case EXPR_ALLOC:
+	case EXPR_APPEND:
 	case EXPR_DEFER:
-	case EXPR_DEFINE:
 	case EXPR_DELETE:
-	case EXPR_FOR:
 	case EXPR_FREE:
-	case EXPR_IF:
 	case EXPR_INSERT:
 	case EXPR_MATCH:
 	case EXPR_PROPAGATE:
-	case EXPR_RETURN:
-	case EXPR_SWITCH:
 	case EXPR_VAARG:
 	case EXPR_VAEND:
 	case EXPR_VASTART:
-	case EXPR_YIELD:
 		return false;
 	}
 	assert(0); // Unreachable
 }
+
+bool
+eval_initializer(struct context *ctx,
+	const struct expression *in,
+	struct expression *out)
+{
+	struct eval_state state = {0}, *prev = ctx->eval;
+	ctx->eval = &state;
+	bool ok = eval_expr(ctx, in, out);
+	ctx->eval = prev;
+	return ok;
+}
@@ -0,0 +1,391 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "check.h"
+#include "eval.h"
+#include "expr.h"
+#include "opt.h"
+#include "types.h"
+#include "util.h"
+
+// Constant folding and dead branch elimination
+//
+// Arithmetic, casts, and logical operators whose operands are all scalar
+// literals are replaced with their value, as computed by eval. An if or switch
+// whose condition folds to a constant is replaced with the branch which is
+// taken, assertions which always pass are dropped, and so are any expressions
+// following an expression of type never in a compound. Struct and tuple
+// expressions whose fields are all literals become literals themselves, which
+// gen can initialize from read-only data.
+
+struct fold_state {
+	// Only used to collect errors from eval, which cause the expression
+	// to be left as-is for the runtime to deal with
+	struct context ctx;
+};
+
+static bool
+foldable_type(const struct type *type)
+{
+	switch (type_dealias(NULL, type)->storage) {
+	case STORAGE_BOOL:
+	case STORAGE_F32:
+	case STORAGE_F64:
+	case STORAGE_FCONST:
+	case STORAGE_I8:
+	case STORAGE_I16:
+	case STORAGE_I32:
+	case STORAGE_I64:
+	case STORAGE_ICONST:
+	case STORAGE_INT:
+	case STORAGE_SIZE:
+	case STORAGE_U8:
+	case STORAGE_U16:
+	case STORAGE_U32:
+	case STORAGE_U64:
+	case STORAGE_UINT:
+	case STORAGE_UINTPTR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool
+is_constant(const struct expression *expr)
+{
+	return expr->type == EXPR_LITERAL && expr->literal.object == NULL
+		&& foldable_type(expr->result);
+}
+
+// eval doesn't truncate the result of every operator to the width of its type,
+// but gen expects integer literals to be in range. Flexible constants are
+// computed in 64 bits, but lowered to int by gen if their range allows, so
+// the result is only usable if it's representable either way.
+static bool
+normalize(struct expression *lit)
+{
+	const struct type *type = type_dealias(NULL, lit->result);
+	if (type->storage == STORAGE_ICONST) {
+		int64_t max = ((int64_t)1 << (builtin_type_int.size * 8 - 1)) - 1;
+		int64_t min = -max - 1;
+		if (type->flexible.min < min || type->flexible.max > max) {
+			return true;
+		}
+		return lit->literal.ival >= min && lit->literal.ival <= max;
+	}
+	if (!type_is_integer(NULL, type) || type->size >= sizeof(uint64_t)) {
+		return true;
+	}
+	unsigned int shift = (sizeof(uint64_t) - type->size) * 8;
+	if (type_is_signed(NULL, type)) {
+		lit->literal.ival = (int64_t)(lit->literal.uval << shift) >> shift;
+	} else {
+		lit->literal.uval &= UINT64_MAX >> shift;
+	}
+	return true;
+}
+
+static void
+fold_eval(struct fold_state *state, struct expression **slot)
+{
+	struct expression *in = *slot;
+	struct expression *out = xcalloc(1, sizeof(struct expression));
+	struct errors *errors = NULL;
+	state->ctx.next = &errors;
+	if (!eval_expr(&state->ctx, in, out) || errors != NULL
+			|| !normalize(out)) {
+		free(out);
+		return;
+	}
+	out->loc = in->loc;
+	*slot = out;
+}
+
+static struct expression *
+mkbool(const struct expression *in, bool value)
+{
+	struct expression *out = xcalloc(1, sizeof(struct expression));
+	out->type = EXPR_LITERAL;
+	out->loc = in->loc;
+	out->result = in->result;
+	out->literal.bval = value;
+	return out;
+}
+
+static void
+fold_binarithm(struct fold_state *state, struct expression **slot)
+{
+	struct expression *expr = *slot;
+	struct expression *lvalue = expr->binarithm.lvalue,
+		*rvalue = expr->binarithm.rvalue;
+
+	switch (expr->binarithm.op) {
+	case BIN_LAND:
+	case BIN_LOR:
+		if (!is_constant(lvalue)) {
+			return;
+		}
+		bool lor = expr->binarithm.op == BIN_LOR;
+		if (lvalue->literal.bval == lor) {
+			*slot = mkbool(expr, lor);
+		} else if (rvalue->result == expr->result) {
+			*slot = rvalue;
+		}
+		return;
+	case BIN_LSHIFT:
+	case BIN_RSHIFT:
+		// The runtime masks the shift amount, and eval doesn't handle
+		// signed operands
+		if (!is_constant(lvalue) || !is_constant(rvalue)
+				|| lvalue->result->storage != rvalue->result->storage
+				|| type_is_flexible(lvalue->result)
+				|| type_is_signed(NULL, lvalue->result)
+				|| rvalue->literal.uval >= lvalue->result->size * 8) {
+			return;
+		}
+		break;
+	case BIN_DIV:
+	case BIN_MODULO:
+		// eval only detects overflow for fixed-width types
+		if (type_is_flexible(lvalue->result) && is_constant(rvalue)
+				&& rvalue->literal.ival == -1) {
+			return;
+		}
+		/* fallthrough */
+	default:
+		if (!is_constant(lvalue) || !is_constant(rvalue)
+				|| lvalue->result->storage != rvalue->result->storage) {
+			return;
+		}
+		break;
+	}
+	fold_eval(state, slot);
+}
+
+static void
+fold_cast(struct fold_state *state, struct expression **slot)
+{
+	struct expression *expr = *slot;
+	if (expr->cast.kind != C_CAST || !is_constant(expr->cast.value)
+			|| !foldable_type(expr->result)) {
+		return;
+	}
+	const struct type *to = type_dealias(NULL, expr->result),
+		*from = type_dealias(NULL, expr->cast.value->result);
+	if (to->storage != from->storage) {
+		if (to->storage == STORAGE_BOOL || from->storage == STORAGE_BOOL) {
+			return;
+		}
+		// Out-of-range conversions are left to the target
+		if (type_is_float(NULL, from) && !type_is_float(NULL, to)) {
+			return;
+		}
+	}
+	fold_eval(state, slot);
+}
+
+static void
+fold_struct(struct fold_state *state, struct expression **slot)
+{
+	struct expression *expr = *slot;
+	if (type_dealias(NULL, expr->result)->storage != STORAGE_STRUCT) {
+		return;
+	}
+	for (const struct expr_struct_field *field = expr->_struct.fields;
+			field; field = field->next) {
+		if (!field->value || field->value->type != EXPR_LITERAL) {
+			return;
+		}
+	}
+	fold_eval(state, slot);
+}
+
+static void
+fold_tuple(struct fold_state *state, struct expression **slot)
+{
+	for (const struct expression_tuple *item = &(*slot)->tuple;
+			item; item = item->next) {
+		if (item->value->type != EXPR_LITERAL) {
+			return;
+		}
+	}
+	fold_eval(state, slot);
+}
+
+static void
+fold_unarithm(struct fold_state *state, struct expression **slot)
+{
+	struct expression *expr = *slot;
+	switch (expr->unarithm.op) {
+	case UN_BNOT:
+	case UN_LNOT:
+	case UN_MINUS:
+		if (is_constant(expr->unarithm.operand)) {
+			fold_eval(state, slot);
+		}
+		break;
+	case UN_ADDRESS:
+	case UN_DEREF:
+		break;
+	}
+}
+
+// Replaces *slot with the branch which is taken, if it can stand in for the
+// whole expression. stmt is set if *slot is a compound item whose value is not
+// used, and last if it is the final one.
+static void
+take_branch(struct expression **slot, struct expression *branch,
+	bool stmt, bool last)
+{
+	struct expression *expr = *slot;
+	if (branch == NULL) {
+		if (type_dealias(NULL, expr->result)->storage != STORAGE_VOID) {
+			return;
+		}
+		struct expression *out = xcalloc(1, sizeof(struct expression));
+		out->type = EXPR_LITERAL;
+		out->loc = expr->loc;
+		out->result = expr->result;
+		*slot = out;
+		return;
+	}
+	if (branch->result == expr->result
+			|| (stmt && branch->result->storage == STORAGE_NEVER)
+			|| (stmt && !last)) {
+		*slot = branch;
+	}
+}
+
+static void
+fold_assert(struct expression **slot)
+{
+	struct expression *expr = *slot;
+	if (expr->assert.cond && is_constant(expr->assert.cond)
+			&& expr->assert.cond->literal.bval) {
+		take_branch(slot, NULL, false, false);
+	}
+}
+
+static void
+fold_if(struct expression **slot, bool stmt, bool last)
+{
+	struct expression *expr = *slot;
+	if (!is_constant(expr->_if.cond)) {
+		return;
+	}
+	take_branch(slot, expr->_if.cond->literal.bval
+		? expr->_if.true_branch : expr->_if.false_branch, stmt, last);
+}
+
+static void
+fold_switch(struct expression **slot, bool stmt, bool last)
+{
+	struct expression *expr = *slot;
+	const struct expression *value = expr->_switch.value;
+	if (!is_constant(value) || type_is_float(NULL, value->result)) {
+		return;
+	}
+
+	const struct switch_case *match = NULL, *_default = NULL;
+	for (const struct switch_case *_case = expr->_switch.cases;
+			_case && !match; _case = _case->next) {
+		if (!_case->options) {
+			_default = _case;
+			continue;
+		}
+		for (const struct case_option *opt = _case->options;
+				opt; opt = opt->next) {
+			if (!is_constant(opt->value)) {
+				return;
+			}
+			bool eq;
+			if (type_dealias(NULL, value->result)->storage == STORAGE_BOOL) {
+				eq = opt->value->literal.bval == value->literal.bval;
+			} else {
+				eq = opt->value->literal.uval == value->literal.uval;
+			}
+			if (eq) {
+				match = _case;
+				break;
+			}
+		}
+	}
+	if (!match) {
+		match = _default;
+	}
+	if (match) {
+		take_branch(slot, match->value, stmt, last);
+	}
+}
+
+static void
+fold_compound(struct expression *expr)
+{
+	for (struct expressions *exprs = &expr->compound.exprs;
+			exprs; exprs = exprs->next) {
+		bool last = exprs->next == NULL;
+		switch (exprs->expr->type) {
+		case EXPR_IF:
+			fold_if(&exprs->expr, true, last);
+			break;
+		case EXPR_SWITCH:
+			fold_switch(&exprs->expr, true, last);
+			break;
+		default:
+			break;
+		}
+		if (exprs->expr->result->storage == STORAGE_NEVER) {
+			exprs->next = NULL;
+		}
+	}
+}
+
+static bool
+fold_visit(struct expression **slot, void *user)
+{
+	struct fold_state *state = user;
+	expr_walk(*slot, fold_visit, state);
+
+	switch ((*slot)->type) {
+	case EXPR_ASSERT:
+		fold_assert(slot);
+		break;
+	case EXPR_BINARITHM:
+		fold_binarithm(state, slot);
+		break;
+	case EXPR_CAST:
+		fold_cast(state, slot);
+		break;
+	case EXPR_COMPOUND:
+		fold_compound(*slot);
+		break;
+	case EXPR_IF:
+		fold_if(slot, false, false);
+		break;
+	case EXPR_STRUCT:
+		fold_struct(state, slot);
+		break;
+	case EXPR_SWITCH:
+		fold_switch(slot, false, false);
+		break;
+	case EXPR_TUPLE:
+		fold_tuple(state, slot);
+		break;
+	case EXPR_UNARITHM:
+		fold_unarithm(state, slot);
+		break;
+	default:
+		break;
+	}
+	return false;
+}
+
+void
+opt_fold(struct declaration *decl)
+{
+	struct fold_state state = {0};
+	fold_visit(&decl->func.body, &state);
+}
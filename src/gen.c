@@ -1,9 +1,11 @@
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include "check.h"
 #include "expr.h"
 #include "gen.h"
+#include "opt.h"
 #include "scope.h"
 #include "type_store.h"
 #include "typedef.h"
@@ -27,6 +29,8 @@ static struct gen_value gen_expr_with(struct gen_context *ctx,
 	struct gen_value *out);
 static void gen_global_decl(struct gen_context *ctx,
 	const struct declaration *decl);
+static struct qbe_value extend(struct gen_context *ctx,
+	struct qbe_value v, const struct type *type);
 
 static struct gen_scope *
 gen_scope_lookup(struct gen_context *ctx, const struct scope *which)
@@ -50,19 +54,42 @@ push_scope(struct gen_context *ctx, const struct scope *scope)
 	return new;
 }
 
+static void gen_scope_exits(struct gen_context *ctx, struct gen_scope *scope);
+
 static void
 pop_scope(struct gen_context *ctx)
 {
 	struct gen_scope *scope = ctx->scope;
+	if (scope->routes) {
+		gen_scope_exits(ctx, scope);
+	}
 	ctx->scope = scope->parent;
 	for (struct gen_defer *defer = scope->defers; defer; /* n/a */) {
 		struct gen_defer *next = defer->next;
 		free(defer);
 		defer = next;
 	}
+	for (struct gen_route *route = scope->routes; route; /* n/a */) {
+		struct gen_route *next = route->next;
+		free(route);
+		route = next;
+	}
 	free(scope);
 }
 
+// Marks the current block as cold; see gen_layout
+static void
+mark_cold(struct gen_context *ctx)
+{
+	struct qbe_statements *body = &ctx->current->body;
+	for (size_t i = body->ln; i > 0; --i) {
+		if (body->stmts[i - 1].type == Q_LABEL) {
+			body->stmts[i - 1].cold = true;
+			return;
+		}
+	}
+}
+
 static void
 gen_defers(struct gen_context *ctx, struct gen_scope *scope)
 {
@@ -84,6 +111,179 @@ gen_defers(struct gen_context *ctx, struct gen_scope *scope)
 	scope->defers = defers;
 }
 
+static struct qbe_value
+defer_label(struct gen_context *ctx, struct gen_defer *defer)
+{
+	if (!defer->blabel.name) {
+		defer->blabel = mklabel(ctx, &defer->label, "defers.%d");
+	}
+	return defer->blabel;
+}
+
+static void
+add_route(struct gen_scope *scope, uint32_t id, struct qbe_value dest)
+{
+	struct gen_route **next = &scope->routes;
+	for (; *next; next = &(*next)->next) {
+		if ((*next)->id == id) {
+			assert(strcmp((*next)->dest.name, dest.name) == 0);
+			return;
+		}
+	}
+	*next = xcalloc(1, sizeof(struct gen_route));
+	(*next)->id = id;
+	(*next)->dest = dest;
+}
+
+// Returns the value of the exit temporary for exits which continue at dest
+static uint32_t
+exit_id(struct gen_context *ctx, const struct qbe_value *dest)
+{
+	if (!ctx->exit.name) {
+		ctx->exit = mkqtmp(ctx, &qbe_word, "exit.%d");
+	}
+	uint32_t id = 0;
+	struct gen_route **next = &ctx->exits;
+	for (; *next; next = &(*next)->next, ++id) {
+		if (strcmp((*next)->dest.name, dest->name) == 0) {
+			return id;
+		}
+	}
+	*next = xcalloc(1, sizeof(struct gen_route));
+	(*next)->id = id;
+	(*next)->dest = *dest;
+	return id;
+}
+
+// Returns the innermost scope with defers to run on an exit to target (or out
+// of the function, if NULL), or NULL if there are none
+static struct gen_scope *
+exit_defers(struct gen_context *ctx, const struct gen_scope *target)
+{
+	for (struct gen_scope *scope = ctx->scope; scope; scope = scope->parent) {
+		if (scope->defers) {
+			return scope;
+		}
+		if (scope == target) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+// Branches to dest through the exit paths of each scope up to and including
+// target (or out of the function, if NULL), running their defers. Each scope's
+// defers are generated once, by gen_scope_exits, and the exit temporary selects
+// where to continue from there. Returns false, having generated nothing, if
+// there are no defers to run.
+static bool
+gen_exit(struct gen_context *ctx,
+	const struct gen_scope *target,
+	struct qbe_value *dest)
+{
+	struct gen_scope *first = exit_defers(ctx, target);
+	if (!first) {
+		return false;
+	}
+	uint32_t id = exit_id(ctx, dest);
+	struct gen_scope *prev = first;
+	for (struct gen_scope *scope = first; scope != target;) {
+		scope = scope->parent;
+		if (!scope) {
+			break;
+		}
+		if (scope->defers) {
+			add_route(prev, id, defer_label(ctx, scope->defers));
+			prev = scope;
+		}
+	}
+	add_route(prev, id, *dest);
+
+	struct qbe_value qid = constw(id);
+	struct qbe_value entry = defer_label(ctx, first->defers);
+	pushi(ctx->current, &ctx->exit, Q_COPY, &qid, NULL);
+	pushi(ctx->current, NULL, Q_JMP, &entry, NULL);
+	return true;
+}
+
+// Generates the exit path of a scope when it's popped, once every exit through
+// it is known. It's placed with the rest at the end of the function.
+static void
+gen_scope_exits(struct gen_context *ctx, struct gen_scope *scope)
+{
+	struct qbe_statements body = ctx->current->body;
+	ctx->current->body = (struct qbe_statements){0};
+
+	// Exits may enter after any defer, and run those before it. Exits within
+	// the deferred expressions get their own exit temporary, so this one
+	// still selects the destination once they've run.
+	struct qbe_value exit = ctx->exit;
+	ctx->exit = (struct qbe_value){0};
+	bool entered = false;
+	struct gen_defer *defers = scope->defers;
+	for (struct gen_defer *defer = defers; defer; defer = defer->next) {
+		if (defer->blabel.name) {
+			push(&ctx->current->body, &defer->label);
+			entered = true;
+		}
+		if (!entered) {
+			continue;
+		}
+		scope->defers = defer->next;
+		push_scope(ctx, defer->expr->defer.scope);
+		gen_expr(ctx, defer->expr->defer.deferred);
+		pop_scope(ctx);
+	}
+	scope->defers = defers;
+	ctx->exit = exit;
+
+	// Exits continuing to the most common destination don't need a test.
+	// Others are tested latest first, as the exit from the end of a
+	// compound is the last one generated.
+	struct gen_route *fallback = NULL;
+	size_t most = 0, nroutes = 0;
+	for (struct gen_route *route = scope->routes; route; route = route->next) {
+		size_t n = 0;
+		for (struct gen_route *other = scope->routes;
+				other; other = other->next) {
+			n += strcmp(route->dest.name, other->dest.name) == 0;
+		}
+		if (n >= most) {
+			fallback = route;
+			most = n;
+		}
+		++nroutes;
+	}
+	struct gen_route **routes = xcalloc(nroutes, sizeof(routes[0]));
+	nroutes = 0;
+	for (struct gen_route *route = scope->routes; route; route = route->next) {
+		routes[nroutes++] = route;
+	}
+	while (nroutes != 0) {
+		struct gen_route *route = routes[--nroutes];
+		if (strcmp(route->dest.name, fallback->dest.name) == 0) {
+			continue;
+		}
+		struct qbe_statement lnext;
+		struct qbe_value bnext = mklabel(ctx, &lnext, ".%d");
+		struct qbe_value match = mkqtmp(ctx, &qbe_word, ".%d");
+		struct qbe_value id = constw(route->id);
+		pushi(ctx->current, &match, Q_CEQW, &ctx->exit, &id, NULL);
+		pushi(ctx->current, NULL, Q_JNZ, &match,
+			&route->dest, &bnext, NULL);
+		push(&ctx->current->body, &lnext);
+	}
+	free(routes);
+	pushi(ctx->current, NULL, Q_JMP, &fallback->dest, NULL);
+
+	struct qbe_statements exits = ctx->current->body;
+	ctx->current->body = body;
+	for (size_t i = 0; i < exits.ln; ++i) {
+		push(&ctx->pads, &exits.stmts[i]);
+	}
+	free(exits.stmts);
+}
+
 static void
 gen_copy_memcpy(struct gen_context *ctx,
 	struct gen_value dest, struct gen_value src)
@@ -137,6 +337,14 @@ gen_store(struct gen_context *ctx,
 
 	struct qbe_value qobj = mkqval(ctx, &object),
 		qval = mkqval(ctx, &value);
+	if (object.kind == GV_PROMOTED) {
+		if (value.kind != GV_CONST) {
+			// Truncate as a store to memory would
+			qval = extend(ctx, qval, object.type);
+		}
+		pushi(ctx->current, &qobj, Q_COPY, &qval, NULL);
+		return;
+	}
 	enum qbe_instr qi = store_for_type(ctx, object.type);
 	pushi(ctx->current, NULL, qi, &qval, &qobj, NULL);
 }
@@ -179,6 +387,10 @@ gen_load(struct gen_context *ctx, struct gen_value object)
 	struct gen_value value = mkgtemp(ctx, object.type, ".%d");
 	struct qbe_value qobj = mkqval(ctx, &object),
 		qval = mkqval(ctx, &value);
+	if (object.kind == GV_PROMOTED) {
+		pushi(ctx->current, &qval, Q_COPY, &qobj, NULL);
+		return value;
+	}
 	enum qbe_instr qi = load_for_type(ctx, object.type);
 	pushi(ctx->current, &qval, qi, &qobj, NULL);
 	return value;
@@ -197,24 +409,171 @@ gen_load_tag(struct gen_context *ctx,
 	pushi(ctx->current, out, load, from, NULL);
 }
 
+// Each entry in the table of fixed aborts holds the source file, line, column,
+// and reason as 32-bit words
+#define ABORT_ENTRY_FIELDS 4
+
 static void
 gen_fixed_abort(struct gen_context *ctx,
 	struct location loc, enum fixed_aborts reason)
 {
-	for (struct gen_scope *scope = ctx->scope; scope; scope = scope->parent) {
-		gen_defers(ctx, scope);
-		if (scope->scope->class == SCOPE_DEFER) {
-			break;
+	mark_cold(ctx);
+
+	if (ctx->naborts == 0) {
+		struct qbe_def *def = xcalloc(1, sizeof(struct qbe_def));
+		def->kind = Q_DATA;
+		def->name = gen_name(&ctx->id, "aborts.%d");
+		def->data.align = 4;
+		def->data.readonly = true;
+		ctx->aborts = def;
+		ctx->abort_item = NULL;
+		ctx->babort = mklabel(ctx, &ctx->abortl, "abort.%d");
+		ctx->abort_site = mkqtmp(ctx, &qbe_long, "abort.%d");
+	}
+	uint32_t entry[ABORT_ENTRY_FIELDS] = {
+		loc.file, loc.lineno, loc.colno, reason,
+	};
+	for (size_t i = 0; i < ABORT_ENTRY_FIELDS; ++i) {
+		struct qbe_data_item *item = &ctx->aborts->data.items;
+		if (ctx->abort_item) {
+			item = ctx->abort_item->next =
+				xcalloc(1, sizeof(struct qbe_data_item));
 		}
+		item->type = QD_VALUE;
+		item->value = constw(entry[i]);
+		ctx->abort_item = item;
+	}
+
+	struct qbe_value site = constl(ctx->naborts++);
+	pushi(ctx->current, &ctx->abort_site, Q_COPY, &site, NULL);
+
+	struct gen_scope *target = ctx->scope;
+	while (target && target->scope->class != SCOPE_DEFER
+			&& target->scope->class != SCOPE_FUNC) {
+		target = target->parent;
+	}
+	if (!gen_exit(ctx, target, &ctx->babort)) {
+		pushi(ctx->current, NULL, Q_JMP, &ctx->babort, NULL);
+	}
+}
+
+// Emits a table of the paths of the unit's source files, indexed by file
+static struct qbe_value
+gen_sources_table(struct gen_context *ctx)
+{
+	if (!ctx->sources_table) {
+		struct qbe_def *def = xcalloc(1, sizeof(struct qbe_def));
+		def->kind = Q_DATA;
+		def->name = gen_name(&ctx->id, "sources.%d");
+		def->data.align = 8;
+		def->data.readonly = true;
+		struct qbe_data_item *item = &def->data.items;
+		item->type = QD_VALUE;
+		item->value = constl(0);
+		for (size_t i = 1; i <= nsources; ++i) {
+			item = item->next = xcalloc(1, sizeof(struct qbe_data_item));
+			item->type = QD_VALUE;
+			item->value = mklval(ctx, &ctx->sources[i]);
+		}
+		qbe_append_def(ctx->out, def);
+		ctx->sources_table = def->name;
+	}
+	return (struct qbe_value){
+		.kind = QV_GLOBAL,
+		.type = ctx->arch.ptr,
+		.name = xstrdup(ctx->sources_table),
+	};
+}
+
+// Places the exit paths of the function's scopes and its shared return
+static void
+gen_exits_tail(struct gen_context *ctx)
+{
+	for (size_t i = 0; i < ctx->pads.ln; ++i) {
+		push(&ctx->current->body, &ctx->pads.stmts[i]);
+	}
+	free(ctx->pads.stmts);
+	ctx->pads = (struct qbe_statements){0};
+
+	for (struct gen_route *route = ctx->exits; route; /* n/a */) {
+		struct gen_route *next = route->next;
+		free(route);
+		route = next;
 	}
+	ctx->exits = NULL;
+	ctx->exit = (struct qbe_value){0};
+
+	if (!ctx->bret.name) {
+		return;
+	}
+	push(&ctx->current->body, &ctx->retl);
+	if (ctx->retval.type->size == 0) {
+		pushi(ctx->current, NULL, Q_RET, NULL);
+	} else {
+		struct qbe_value qret = mkqval(ctx, &ctx->retval);
+		pushi(ctx->current, NULL, Q_RET, &qret, NULL);
+	}
+	ctx->bret.name = NULL;
+}
+
+static void
+gen_abort_tail(struct gen_context *ctx)
+{
+	if (ctx->naborts == 0) {
+		return;
+	}
+	ctx->abortl.cold = true;
+	push(&ctx->current->body, &ctx->abortl);
+
+	struct qbe_value path, line, col, reason;
+	if (ctx->naborts == 1) {
+		// No table needed for a single site
+		const struct qbe_data_item *item = &ctx->aborts->data.items;
+		path = mklval(ctx, &ctx->sources[item->value.wval]);
+		item = item->next;
+		line = constl(item->value.wval);
+		item = item->next;
+		col = constl(item->value.wval);
+		item = item->next;
+		reason = constl(item->value.wval);
+		pushi(ctx->current, NULL, Q_CALL, &ctx->rt.fixedabort,
+				&path, &line, &col, &reason, NULL);
+		pushi(ctx->current, NULL, Q_HLT, NULL);
+		ctx->naborts = 0;
+		return;
+	}
+
+	qbe_append_def(ctx->out, ctx->aborts);
+	struct qbe_value table = {
+		.kind = QV_GLOBAL,
+		.type = ctx->arch.ptr,
+		.name = xstrdup(ctx->aborts->name),
+	};
+	struct qbe_value entry = mkqtmp(ctx, ctx->arch.ptr, ".%d");
+	struct qbe_value size = constl(ABORT_ENTRY_FIELDS * 4);
+	pushi(ctx->current, &entry, Q_MUL, &ctx->abort_site, &size, NULL);
+	pushi(ctx->current, &entry, Q_ADD, &table, &entry, NULL);
+
+	struct qbe_value *fields[] = { &path, &line, &col, &reason };
+	struct qbe_value offs = constl(4);
+	for (size_t i = 0; i < ABORT_ENTRY_FIELDS; ++i) {
+		if (i != 0) {
+			pushi(ctx->current, &entry, Q_ADD, &entry, &offs, NULL);
+		}
+		*fields[i] = mkqtmp(ctx, &qbe_long, ".%d");
+		pushi(ctx->current, fields[i], Q_LOADUW, &entry, NULL);
+	}
+
+	struct qbe_value sources = gen_sources_table(ctx);
+	offs = constl(ctx->arch.ptr->size);
+	pushi(ctx->current, &path, Q_MUL, &path, &offs, NULL);
+	pushi(ctx->current, &path, Q_ADD, &sources, &path, NULL);
+	pushi(ctx->current, &path, Q_LOADL, &path, NULL);
 
-	struct qbe_value path = mklval(ctx, &ctx->sources[loc.file]);
-	struct qbe_value line = constl(loc.lineno);
-	struct qbe_value col = constl(loc.colno);
-	struct qbe_value tmp = constl(reason);
 	pushi(ctx->current, NULL, Q_CALL, &ctx->rt.fixedabort,
-			&path, &line, &col, &tmp, NULL);
+			&path, &line, &col, &reason, NULL);
 	pushi(ctx->current, NULL, Q_HLT, NULL);
+	ctx->naborts = 0;
 }
 
 static struct gen_value
@@ -254,6 +613,25 @@ gen_access_ident(struct gen_context *ctx, const struct scope_object *obj)
 	abort(); // Invariant
 }
 
+// Returns the binding expr refers to if its header was loaded ahead of time by
+// gen_binding_header, or NULL.
+static const struct gen_binding *
+cached_header(struct gen_context *ctx, const struct expression *expr)
+{
+	if (expr->type != EXPR_ACCESS
+			|| expr->access.type != ACCESS_IDENTIFIER
+			|| expr->access.object->otype != O_BIND) {
+		return NULL;
+	}
+	for (const struct gen_binding *gb = ctx->bindings;
+			gb; gb = gb->next) {
+		if (gb->object == expr->access.object) {
+			return gb->data.type || gb->length.type ? gb : NULL;
+		}
+	}
+	return NULL;
+}
+
 static void
 gen_indexing_bounds_check(struct gen_context *ctx,
 	struct location loc,
@@ -277,12 +655,21 @@ gen_indexing_bounds_check(struct gen_context *ctx,
 static struct gen_value
 gen_access_index(struct gen_context *ctx, const struct expression *expr)
 {
-	struct gen_value glval = gen_expr(ctx, expr->access.array);
-	glval = gen_autoderef(ctx, glval);
-	struct qbe_value qlval = mkqval(ctx, &glval);
-	struct qbe_value qival = mkqtmp(ctx, ctx->arch.ptr, ".%d");
+	struct qbe_value qlval, qival = mkqtmp(ctx, ctx->arch.ptr, ".%d");
 	bool checkbounds = !expr->access.bounds_checked;
 	struct qbe_value length;
+	const struct gen_binding *cached =
+		cached_header(ctx, expr->access.array);
+	if (cached && cached->data.type
+			&& (!checkbounds || cached->length.type)) {
+		qlval = cached->data;
+		length = cached->length;
+		goto index;
+	}
+
+	struct gen_value glval = gen_expr(ctx, expr->access.array);
+	glval = gen_autoderef(ctx, glval);
+	qlval = mkqval(ctx, &glval);
 	const struct type *ty = type_dealias(NULL, glval.type);
 	switch (ty->storage) {
 	case STORAGE_SLICE:;
@@ -290,11 +677,13 @@ gen_access_index(struct gen_context *ctx, const struct expression *expr)
 		struct qbe_value base = mkqtmp(ctx, ctx->arch.ptr, ".%d");
 		pushi(ctx->current, &base, load, &qlval, NULL);
 
-		struct qbe_value temp = mkqtmp(ctx, ctx->arch.ptr, ".%d");
-		length = mkqtmp(ctx, ctx->arch.sz, "len.%d");
-		struct qbe_value offset = constl(builtin_type_size.size);
-		pushi(ctx->current, &temp, Q_ADD, &qlval, &offset, NULL);
-		pushi(ctx->current, &length, load, &temp, NULL);
+		if (checkbounds) {
+			struct qbe_value temp = mkqtmp(ctx, ctx->arch.ptr, ".%d");
+			length = mkqtmp(ctx, ctx->arch.sz, "len.%d");
+			struct qbe_value offset = constl(builtin_type_size.size);
+			pushi(ctx->current, &temp, Q_ADD, &qlval, &offset, NULL);
+			pushi(ctx->current, &length, load, &temp, NULL);
+		}
 
 		qlval = base;
 		break;
@@ -309,6 +698,7 @@ gen_access_index(struct gen_context *ctx, const struct expression *expr)
 		assert(0); // Unreachable
 	}
 
+index:;
 	struct gen_value index = gen_expr(ctx, expr->access.index);
 	struct qbe_value qindex = mkqval(ctx, &index);
 	struct qbe_value itemsz = constl(expr->result->size);
@@ -397,6 +787,368 @@ gen_expr_access(struct gen_context *ctx, const struct expression *expr)
 	return gen_load(ctx, addr);
 }
 
+// Returns true if the given expression is a literal whose representation is all
+// zero bytes
+static bool
+literal_is_zero(const struct expression *expr)
+{
+	if (expr->type != EXPR_LITERAL || expr->literal.object) {
+		return false;
+	}
+	const struct type *type = type_dealias(NULL, expr->result);
+	switch (type->storage) {
+	case STORAGE_ARRAY:
+		if (expr->literal.packed) {
+			const struct packed_literal *packed = expr->literal.packed;
+			for (size_t i = 0; i < packed->len; ++i) {
+				if (packed->data[i] != 0) {
+					return false;
+				}
+			}
+			return true;
+		}
+		for (const struct array_literal *item = expr->literal.array;
+				item; item = item->next) {
+			if (!literal_is_zero(item->value)) {
+				return false;
+			}
+		}
+		return true;
+	case STORAGE_BOOL:
+		return !expr->literal.bval;
+	case STORAGE_F32:
+	case STORAGE_F64:
+	case STORAGE_FCONST:
+		return expr->literal.fval == 0 && !signbit(expr->literal.fval);
+	case STORAGE_NULL:
+		return true;
+	case STORAGE_POINTER:
+	case STORAGE_RCONST:
+	case STORAGE_RUNE:
+		return expr->literal.uval == 0;
+	case STORAGE_STRING:
+		return expr->literal.string.len == 0;
+	case STORAGE_STRUCT:
+	case STORAGE_UNION:
+		for (const struct struct_literal *field = expr->literal._struct;
+				field; field = field->next) {
+			if (!literal_is_zero(field->value)) {
+				return false;
+			}
+		}
+		return true;
+	case STORAGE_TUPLE:
+		for (const struct tuple_literal *item = expr->literal.tuple;
+				item; item = item->next) {
+			if (!literal_is_zero(item->value)) {
+				return false;
+			}
+		}
+		return true;
+	default:
+		return type_is_integer(NULL, type) && expr->literal.uval == 0;
+	}
+}
+
+// Aggregate literals with at least this many scalar members are initialized
+// from a read-only template, see gen_template
+#define TEMPLATE_MIN 16
+
+// Returns the number of stores gen_expr_literal_at would use for a literal, or
+// zero if it has members which are not constant.
+static size_t
+literal_stores(const struct expression *expr)
+{
+	if (expr->type != EXPR_LITERAL) {
+		return 0;
+	}
+	const struct type *type = type_dealias(NULL, expr->result);
+	size_t n = 0, m;
+	switch (type->storage) {
+	case STORAGE_ARRAY:
+		if (type->array.expandable) {
+			return 0; // See gen_fill
+		} else if (expr->literal.packed) {
+			return type->array.length;
+		}
+		size_t len = 0;
+		for (const struct array_literal *item = expr->literal.array;
+				item; item = item->next, ++len) {
+			if ((m = literal_stores(item->value)) == 0) {
+				return 0;
+			}
+			n += m;
+		}
+		if (len == 0) {
+			return 0;
+		} else if (len < type->array.length) {
+			// The last member is repeated, see gen_literal_array_at
+			n += (type->array.length - len) * m;
+		}
+		return n;
+	case STORAGE_STRUCT:
+		for (const struct struct_literal *field = expr->literal._struct;
+				field; field = field->next) {
+			if ((m = literal_stores(field->value)) == 0) {
+				return 0;
+			}
+			n += m;
+		}
+		return n;
+	case STORAGE_TUPLE:
+		for (const struct tuple_literal *item = expr->literal.tuple;
+				item; item = item->next) {
+			if ((m = literal_stores(item->value)) == 0) {
+				return 0;
+			}
+			n += m;
+		}
+		return n;
+	case STORAGE_STRING:
+		return 3;
+	case STORAGE_SLICE:
+	case STORAGE_TAGGED:
+	case STORAGE_UNION:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+static struct gen_strlit *intern_string(struct gen_context *ctx,
+	const char *value, size_t len);
+
+static struct qbe_data_item *gen_data_item(struct gen_context *,
+	const struct expression *, struct qbe_data_item *);
+
+// Returns a read-only copy of a literal in data, which may be a packed array.
+static struct gen_value
+gen_template(struct gen_context *ctx, const struct expression *expr)
+{
+	struct gen_value tmpl = {
+		.kind = GV_GLOBAL,
+		.type = expr->result,
+	};
+	const struct packed_literal *packed = expr->literal.packed;
+	if (packed) {
+		struct gen_strlit *lit = intern_string(ctx,
+			packed->data, packed->len);
+		assert(lit->data);
+		tmpl.name = xstrdup(lit->data);
+		return tmpl;
+	}
+
+	struct qbe_def *def = xcalloc(1, sizeof(struct qbe_def));
+	def->kind = Q_DATA;
+	def->name = gen_name(&ctx->id, "template.%d");
+	def->file = expr->loc.file;
+	def->data.align = expr->result->align;
+	def->data.readonly = true;
+	gen_data_item(ctx, expr, &def->data.items);
+	qbe_append_def(ctx->out, def);
+	tmpl.name = xstrdup(def->name);
+	return tmpl;
+}
+
+// Returns true if a literal should be copied from a template by
+// gen_expr_literal_at rather than stored member by member.
+static bool
+literal_templated(const struct expression *expr)
+{
+	return expr->literal.packed || literal_stores(expr) >= TEMPLATE_MIN;
+}
+
+// Returns the value of every byte in the representation of a literal, or -1 if
+// they aren't all the same
+static int
+literal_byte(const struct expression *expr)
+{
+	if (literal_is_zero(expr)) {
+		return 0;
+	}
+	if (expr->type != EXPR_LITERAL || expr->literal.object) {
+		return -1;
+	}
+	const struct type *type = type_dealias(NULL, expr->result);
+	if (type->storage == STORAGE_ENUM) {
+		type = type->alias.type;
+	}
+	uint64_t bits;
+	switch (type->storage) {
+	case STORAGE_BOOL:
+		bits = expr->literal.bval;
+		break;
+	case STORAGE_F32:;
+		float f32 = (float)expr->literal.fval;
+		uint32_t u32;
+		memcpy(&u32, &f32, sizeof(u32));
+		bits = u32;
+		break;
+	case STORAGE_F64:
+		memcpy(&bits, &expr->literal.fval, sizeof(bits));
+		break;
+	case STORAGE_RUNE:
+		bits = expr->literal.rune;
+		break;
+	default:
+		if (!type_is_integer(NULL, type) || type->size > sizeof(bits)) {
+			return -1;
+		}
+		bits = expr->literal.uval;
+		break;
+	}
+	int byte = bits & 0xff;
+	for (size_t i = 1; i < type->size; ++i) {
+		if ((int)(bits >> (i * 8) & 0xff) != byte) {
+			return -1;
+		}
+	}
+	return byte;
+}
+
+// Returns literal_byte of the member an expandable array literal is filled
+// with, or -1
+static int
+expandable_byte(const struct expression *expr)
+{
+	if (expr->type != EXPR_LITERAL || expr->literal.packed
+			|| !expr->literal.array) {
+		return -1;
+	}
+	const struct array_literal *item = expr->literal.array;
+	while (item->next) {
+		item = item->next;
+	}
+	return literal_byte(item->value);
+}
+
+// Fills count array members following the one at src with copies of it. byte is
+// the value of every byte of that member if known (see literal_byte), in which
+// case the members are filled with memset. Otherwise, short runs of scalars are
+// stored one by one, and anything else is filled by copying the filled region
+// after itself until it covers all of the members, so that no copy overlaps.
+static void
+gen_fill(struct gen_context *ctx, const struct type *membtype,
+	struct qbe_value *src, struct qbe_value *count, int byte)
+{
+	size_t msize = membtype->size;
+	struct qbe_value qmsize = constl(msize);
+	struct qbe_value size;
+	if (count->kind == QV_CONST) {
+		size = constl(count->lval * msize);
+	} else {
+		size = mkqtmp(ctx, ctx->arch.sz, ".%d");
+		pushi(ctx->current, &size, Q_MUL, count, &qmsize, NULL);
+	}
+
+	struct qbe_value ptr = mkqtmp(ctx, ctx->arch.ptr, ".%d");
+	if (byte >= 0) {
+		struct qbe_value val = constl(byte);
+		pushi(ctx->current, &ptr, Q_ADD, src, &qmsize, NULL);
+		pushi(ctx->current, NULL, Q_CALL, &ctx->rt.memset,
+			&ptr, &val, &size, NULL);
+		return;
+	}
+
+	if (count->kind == QV_CONST && size.lval <= 128
+			&& !type_is_aggregate(type_dealias(NULL, membtype))) {
+		struct gen_value item = {
+			.kind = GV_TEMP,
+			.type = membtype,
+			.name = src->name,
+		};
+		struct gen_value last = gen_load(ctx, item);
+		item.name = ptr.name;
+		for (size_t i = 1; i <= count->lval; ++i) {
+			struct qbe_value offs = constl(i * msize);
+			pushi(ctx->current, &ptr, Q_ADD, src, &offs, NULL);
+			gen_store(ctx, item, last);
+		}
+		return;
+	}
+
+	if (count->kind == QV_CONST) {
+		size_t total = size.lval + msize;
+		for (size_t filled = msize; filled < total; filled *= 2) {
+			size_t chunk = total - filled < filled
+				? total - filled : filled;
+			struct qbe_value offs = constl(filled);
+			struct qbe_value qchunk = constl(chunk);
+			pushi(ctx->current, &ptr, Q_ADD, src, &offs, NULL);
+			if (chunk <= 128) {
+				pushi(ctx->current, NULL, Q_BLIT,
+					src, &ptr, &qchunk, NULL);
+			} else {
+				pushi(ctx->current, NULL, Q_CALL, &ctx->rt.memcpy,
+					&ptr, src, &qchunk, NULL);
+			}
+		}
+		return;
+	}
+
+	struct qbe_statement lloop, lbody, lshort, lcopy, lend;
+	struct qbe_value bloop = mklabel(ctx, &lloop, "fill.%d");
+	struct qbe_value bbody = mklabel(ctx, &lbody, ".%d");
+	struct qbe_value bshort = mklabel(ctx, &lshort, ".%d");
+	struct qbe_value bcopy = mklabel(ctx, &lcopy, ".%d");
+	struct qbe_value bend = mklabel(ctx, &lend, ".%d");
+
+	struct qbe_value total = mkqtmp(ctx, ctx->arch.sz, ".%d");
+	struct qbe_value filled = mkqtmp(ctx, ctx->arch.sz, ".%d");
+	struct qbe_value remain = mkqtmp(ctx, ctx->arch.sz, ".%d");
+	struct qbe_value chunk = mkqtmp(ctx, ctx->arch.sz, ".%d");
+	struct qbe_value cmpres = mkqtmp(ctx, &qbe_word, ".%d");
+	struct qbe_value zero = constl(0);
+	pushi(ctx->current, &total, Q_ADD, &size, &qmsize, NULL);
+	pushi(ctx->current, &filled, Q_COPY, &qmsize, NULL);
+
+	push(&ctx->current->body, &lloop);
+	pushi(ctx->current, &remain, Q_SUB, &total, &filled, NULL);
+	pushi(ctx->current, &cmpres, Q_CNEL, &remain, &zero, NULL);
+	pushi(ctx->current, NULL, Q_JNZ, &cmpres, &bbody, &bend, NULL);
+
+	push(&ctx->current->body, &lbody);
+	pushi(ctx->current, &chunk, Q_COPY, &filled, NULL);
+	pushi(ctx->current, &cmpres, Q_CULTL, &remain, &filled, NULL);
+	pushi(ctx->current, NULL, Q_JNZ, &cmpres, &bshort, &bcopy, NULL);
+	push(&ctx->current->body, &lshort);
+	pushi(ctx->current, &chunk, Q_COPY, &remain, NULL);
+
+	push(&ctx->current->body, &lcopy);
+	pushi(ctx->current, &ptr, Q_ADD, src, &filled, NULL);
+	pushi(ctx->current, NULL, Q_CALL, &ctx->rt.memcpy,
+		&ptr, src, &chunk, NULL);
+	pushi(ctx->current, &filled, Q_ADD, &filled, &chunk, NULL);
+	pushi(ctx->current, NULL, Q_JMP, &bloop, NULL);
+
+	push(&ctx->current->body, &lend);
+}
+
+// Points data at a stack slot reserved in the prelude for the slice storage of
+// an alloc which doesn't escape.
+static void
+gen_stack_slot(struct gen_context *ctx, const struct expression *expr,
+	struct qbe_value *data)
+{
+	const struct type *sltype = type_dealias(NULL, expr->result);
+	const struct type *membtype = sltype->array.members;
+	size_t length;
+	if (expr->alloc.cap) {
+		assert(expr->alloc.cap->type == EXPR_LITERAL); // See opt_escape
+		length = expr->alloc.cap->literal.uval;
+	} else {
+		const struct type *inittype =
+			type_dealias(NULL, expr->alloc.init->result);
+		assert(inittype->storage == STORAGE_ARRAY);
+		length = inittype->array.length;
+	}
+	struct qbe_value slot = mkqtmp(ctx, ctx->arch.ptr, "object.%d");
+	struct qbe_value sz = constl(length * membtype->size);
+	enum qbe_instr alloc = alloc_for_align(membtype->align);
+	pushprei(ctx->current, &slot, alloc, &sz, NULL);
+	pushi(ctx->current, data, Q_COPY, &slot, NULL);
+}
+
 static void
 gen_alloc_slice_at(struct gen_context *ctx,
 		const struct expression *expr,
@@ -437,6 +1189,11 @@ gen_alloc_slice_at(struct gen_context *ctx,
 		qcap = length;
 	}
 
+	// Memory from rt.calloc already holds an expanded zero initializer
+	bool zeroed = !expr->alloc.stack && expand
+		&& inittype->storage == STORAGE_ARRAY
+		&& literal_is_zero(expr->alloc.init);
+
 	// reused in next few blocks
 	struct qbe_value cmpres = mkqtmp(ctx, &qbe_word, ".%d");
 
@@ -464,14 +1221,19 @@ gen_alloc_slice_at(struct gen_context *ctx,
 	pushi(ctx->current, &cmpres, Q_CNEL, &size, &zero, NULL);
 	pushi(ctx->current, NULL, Q_JNZ, &cmpres, &bnonzero, &bzero, NULL);
 	push(&ctx->current->body, &lnonzero);
-	pushi(ctx->current, &data, Q_CALL, &ctx->rt.malloc, &size, NULL);
+	if (expr->alloc.stack) {
+		gen_stack_slot(ctx, expr, &data);
+	} else {
+		pushi(ctx->current, &data, Q_CALL,
+			zeroed ? &ctx->rt.calloc : &ctx->rt.malloc, &size, NULL);
 
-	struct qbe_statement linvalid;
-	struct qbe_value binvalid = mklabel(ctx, &linvalid, ".%d");
-	pushi(ctx->current, &cmpres, Q_CNEL, &data, &zero, NULL);
-	pushi(ctx->current, NULL, Q_JNZ, &cmpres, &bzero, &binvalid, NULL);
-	push(&ctx->current->body, &linvalid);
-	gen_fixed_abort(ctx, expr->loc, ABORT_ALLOC_FAILURE);
+		struct qbe_statement linvalid;
+		struct qbe_value binvalid = mklabel(ctx, &linvalid, ".%d");
+		pushi(ctx->current, &cmpres, Q_CNEL, &data, &zero, NULL);
+		pushi(ctx->current, NULL, Q_JNZ, &cmpres, &bzero, &binvalid, NULL);
+		push(&ctx->current->body, &linvalid);
+		gen_fixed_abort(ctx, expr->loc, ABORT_ALLOC_FAILURE);
+	}
 	push(&ctx->current->body, &lzero);
 
 	struct qbe_value base = mklval(ctx, &out);
@@ -491,7 +1253,9 @@ gen_alloc_slice_at(struct gen_context *ctx,
 	pushi(ctx->current, &ptr, Q_ADD, &base, &offset, NULL);
 	pushi(ctx->current, NULL, store, &qcap, &ptr, NULL);
 
-	if (inittype->storage == STORAGE_ARRAY) {
+	if (zeroed) {
+		return;
+	} else if (inittype->storage == STORAGE_ARRAY) {
 		struct gen_value storage = (struct gen_value){
 			.kind = GV_TEMP,
 			.type = inittype,
@@ -510,14 +1274,13 @@ gen_alloc_slice_at(struct gen_context *ctx,
 	}
 
 	struct qbe_value last = mkqtmp(ctx, ctx->arch.ptr, ".%d");
-	struct qbe_value next = mkqtmp(ctx, ctx->arch.ptr, ".%d");
-	pushi(ctx->current, &next, Q_MUL, &length, &isize, NULL);
-	pushi(ctx->current, &next, Q_ADD, &next, &data, NULL);
-	pushi(ctx->current, &last, Q_SUB, &next, &isize, NULL);
+	pushi(ctx->current, &last, Q_MUL, &length, &isize, NULL);
+	pushi(ctx->current, &last, Q_ADD, &last, &data, NULL);
+	pushi(ctx->current, &last, Q_SUB, &last, &isize, NULL);
 	struct qbe_value remain = mkqtmp(ctx, ctx->arch.sz, ".%d");
 	pushi(ctx->current, &remain, Q_SUB, &qcap, &length, NULL);
-	pushi(ctx->current, &remain, Q_MUL, &remain, &isize, NULL);
-	pushi(ctx->current, NULL, Q_CALL, &ctx->rt.memcpy, &next, &last, &remain, NULL);
+	gen_fill(ctx, sltype->array.members, &last, &remain,
+		expandable_byte(expr->alloc.init));
 }
 
 static struct gen_value
@@ -531,12 +1294,22 @@ gen_expr_alloc_init_with(struct gen_context *ctx,
 	assert(objtype->storage == STORAGE_POINTER);
 	objtype = objtype->pointer.referent;
 
+	bool zeroed = !expr->alloc.stack
+		&& type_dealias(NULL, objtype)->storage == STORAGE_ARRAY
+		&& literal_is_zero(expr->alloc.init);
 	struct qbe_value sz = constl(objtype->size);
 	struct gen_value result = mkgtemp(ctx, expr->result, ".%d");
 	struct qbe_value qresult = mkqval(ctx, &result);
-	pushi(ctx->current, &qresult, Q_CALL, &ctx->rt.malloc, &sz, NULL);
+	if (expr->alloc.stack) {
+		enum qbe_instr alloc = alloc_for_align(objtype->align);
+		pushprei(ctx->current, &qresult, alloc, &sz, NULL);
+	} else {
+		pushi(ctx->current, &qresult, Q_CALL,
+			zeroed ? &ctx->rt.calloc : &ctx->rt.malloc, &sz, NULL);
+	}
 
-	if (!(type_dealias(NULL, expr->result)->pointer.flags & PTR_NULLABLE)) {
+	if (!expr->alloc.stack && !(type_dealias(NULL, expr->result)->pointer.flags
+			& PTR_NULLABLE)) {
 		struct qbe_statement linvalid, lvalid;
 		struct qbe_value cmpres = mkqtmp(ctx, &qbe_word, ".%d");
 		struct qbe_value zero = constl(0);
@@ -550,12 +1323,14 @@ gen_expr_alloc_init_with(struct gen_context *ctx,
 		push(&ctx->current->body, &lvalid);
 	}
 
-	struct gen_value object = {
-		.kind = GV_TEMP,
-		.type = objtype,
-		.name = result.name,
-	};
-	gen_expr_at(ctx, expr->alloc.init, object);
+	if (!zeroed) {
+		struct gen_value object = {
+			.kind = GV_TEMP,
+			.type = objtype,
+			.name = result.name,
+		};
+		gen_expr_at(ctx, expr->alloc.init, object);
+	}
 	if (out) {
 		gen_store(ctx, *out, result);
 	}
@@ -645,12 +1420,16 @@ gen_expr_alloc_copy_with(struct gen_context *ctx,
 	struct qbe_value membsz = constl(result->array.members->size);
 	pushi(ctx->current, &sz, Q_MUL, &membsz, &length, NULL);
 
-	pushi(ctx->current, &newdata, Q_CALL, &ctx->rt.malloc, &sz, NULL);
-	pushi(ctx->current, &cmpres, Q_CNEL, &newdata, &zero, NULL);
-	pushi(ctx->current, NULL, Q_JNZ, &cmpres, &bcopy, &binvalid, NULL);
+	if (expr->alloc.stack) {
+		gen_stack_slot(ctx, expr, &newdata);
+	} else {
+		pushi(ctx->current, &newdata, Q_CALL, &ctx->rt.malloc, &sz, NULL);
+		pushi(ctx->current, &cmpres, Q_CNEL, &newdata, &zero, NULL);
+		pushi(ctx->current, NULL, Q_JNZ, &cmpres, &bcopy, &binvalid, NULL);
 
-	push(&ctx->current->body, &linvalid);
-	gen_fixed_abort(ctx, expr->loc, ABORT_ALLOC_FAILURE);
+		push(&ctx->current->body, &linvalid);
+		gen_fixed_abort(ctx, expr->loc, ABORT_ALLOC_FAILURE);
+	}
 
 	push(&ctx->current->body, &lcopy);
 	pushi(ctx->current, NULL, Q_CALL, &ctx->rt.memcpy, &newdata, &srcdata, &sz, NULL);
@@ -695,11 +1474,13 @@ gen_expr_assert(struct gen_context *ctx, const struct expression *expr)
 	}
 
 	if (expr->assert.message) {
+		mark_cold(ctx);
 		struct gen_value msg = gen_expr(ctx, expr->assert.message);
 		for (struct gen_scope *scope = ctx->scope;
 				scope; scope = scope->parent) {
 			gen_defers(ctx, scope);
-			if (scope->scope->class == SCOPE_DEFER) {
+			if (scope->scope->class == SCOPE_DEFER
+					|| scope->scope->class == SCOPE_FUNC) {
 				break;
 			}
 		}
@@ -764,14 +1545,11 @@ gen_expr_assign_slice_expandable(struct gen_context *ctx, const struct expressio
 	enum qbe_instr store = store_for_type(ctx, sltype);
 	pushi(ctx->current, NULL, store, &vdata, &odata, NULL);
 
-	// perform the copy minus the first element
-	struct qbe_value isize = constl(sltype->size);
-	struct qbe_value next = mkqtmp(ctx, ctx->arch.ptr, ".%d");
-	pushi(ctx->current, &next, Q_ADD, &odata, &isize, NULL);
+	// fill the rest from the first item
 	struct qbe_value one = constl(1);
 	pushi(ctx->current, &olen, Q_SUB, &olen, &one, NULL);
-	pushi(ctx->current, &olen, Q_MUL, &olen, &isize, NULL);
-	pushi(ctx->current, NULL, Q_CALL, &ctx->rt.memcpy, &next, &odata, &olen, NULL);
+	gen_fill(ctx, sltype, &odata, &olen,
+		expandable_byte(expr->assign.value));
 	
 	push(&ctx->current->body, &lzero);
 	
@@ -957,38 +1735,251 @@ gen_expr_binarithm(struct gen_context *ctx, const struct expression *expr)
 		if (expr->binarithm.rvalue->result->storage != STORAGE_NEVER) {
 			pushi(ctx->current, NULL, Q_JMP, &bshort, NULL);
 		}
-		push(&ctx->current->body, &lshort);
-		return result;
+		push(&ctx->current->body, &lshort);
+		return result;
+	}
+
+	struct gen_value lvalue = gen_expr(ctx, expr->binarithm.lvalue);
+	struct gen_value rvalue = gen_expr(ctx, expr->binarithm.rvalue);
+	struct qbe_value qlval = mkqval(ctx, &lvalue);
+	struct qbe_value qrval = mkqval(ctx, &rvalue);
+
+	if (bin_extend[expr->assign.op][0]) {
+		qlval = extend(ctx, qlval, ltype);
+	}
+	if (bin_extend[expr->assign.op][1]) {
+		qrval = extend(ctx, qrval, rtype);
+	}
+
+	assert((ltype->storage == STORAGE_STRING) == (rtype->storage == STORAGE_STRING));
+	if (ltype->storage == STORAGE_STRING) {
+		pushi(ctx->current, &qresult, Q_CALL,
+			&ctx->rt.strcmp, &qlval, &qrval, NULL);
+		if (expr->binarithm.op == BIN_NEQUAL) {
+			struct qbe_value zero = constw(0);
+			pushi(ctx->current, &qresult, Q_CEQW, &qresult, &zero, NULL);
+		} else {
+			assert(expr->binarithm.op == BIN_LEQUAL);
+		}
+		return result;
+	}
+	enum qbe_instr instr = binarithm_for_op(ctx, expr->binarithm.op,
+		expr->binarithm.lvalue->result);
+	pushi(ctx->current, &qresult, instr, &qlval, &qrval, NULL);
+	return result;
+}
+
+static void
+record_addressed(struct gen_context *ctx, const struct scope_object *obj)
+{
+	if (ctx->naddressed >= ctx->addressed_sz) {
+		ctx->addressed_sz = ctx->addressed_sz
+			? ctx->addressed_sz * 2 : 16;
+		ctx->addressed = xrealloc(ctx->addressed,
+			ctx->addressed_sz * sizeof(ctx->addressed[0]));
+	}
+	ctx->addressed[ctx->naddressed++] = obj;
+}
+
+static void
+record_header_read(struct gen_context *ctx,
+	const struct expression *expr, unsigned int fields)
+{
+	if (expr->type != EXPR_ACCESS
+			|| expr->access.type != ACCESS_IDENTIFIER
+			|| expr->access.object->otype != O_BIND) {
+		return;
+	}
+	const struct scope_object *obj = expr->access.object;
+	enum type_storage storage = type_dealias(NULL, obj->type)->storage;
+	if (storage != STORAGE_SLICE && storage != STORAGE_STRING) {
+		return;
+	}
+	for (size_t i = 0; i < ctx->nheaders; ++i) {
+		if (ctx->headers[i].object == obj) {
+			ctx->headers[i].fields |= fields;
+			return;
+		}
+	}
+	if (ctx->nheaders >= ctx->headers_sz) {
+		ctx->headers_sz = ctx->headers_sz ? ctx->headers_sz * 2 : 16;
+		ctx->headers = xrealloc(ctx->headers,
+			ctx->headers_sz * sizeof(ctx->headers[0]));
+	}
+	ctx->headers[ctx->nheaders++] = (struct gen_header_reads){
+		.object = obj,
+		.fields = fields,
+	};
+}
+
+// Records the aggregate binding, if any, whose storage expr refers to by way of
+// field, index, or tuple accesses and casts, as it may be written through expr.
+// The members of a slice are stored apart from it.
+static void
+scan_modified(struct gen_context *ctx, const struct expression *expr)
+{
+	while (true) {
+		switch (expr->type) {
+		case EXPR_ACCESS:
+			switch (expr->access.type) {
+			case ACCESS_IDENTIFIER:;
+				const struct scope_object *obj = expr->access.object;
+				if (type_is_aggregate(type_dealias(NULL, obj->type))) {
+					record_addressed(ctx, obj);
+				}
+				return;
+			case ACCESS_INDEX:
+				expr = expr->access.array;
+				if (type_dealias(NULL, expr->result)->storage
+						== STORAGE_SLICE) {
+					return;
+				}
+				break;
+			case ACCESS_FIELD:
+				expr = expr->access._struct;
+				break;
+			case ACCESS_TUPLE:
+				expr = expr->access.tuple;
+				break;
+			}
+			break;
+		case EXPR_CAST:
+			expr = expr->cast.value;
+			break;
+		default:
+			return;
+		}
+	}
+}
+
+// Records each binding in the current function whose address is taken, or
+// whose storage may be written to after it is initialized. The remainder may be
+// promoted to QBE temporaries if they are scalars, or refer to a read-only
+// template if they are initialized with a constant aggregate.
+static bool
+scan_addressed(struct expression **slot, void *user)
+{
+	struct gen_context *ctx = user;
+	const struct expression *expr = *slot;
+	switch (expr->type) {
+	case EXPR_ACCESS:
+		if (expr->access.type == ACCESS_INDEX) {
+			record_header_read(ctx, expr->access.array, HEADER_DATA
+				| (expr->access.bounds_checked ? 0 : HEADER_LENGTH));
+		}
+		break;
+	case EXPR_APPEND:
+	case EXPR_INSERT:;
+		// Both write to the header of the slice they add to
+		const struct expression *object = expr->append.object;
+		if (expr->type == EXPR_INSERT) {
+			assert(object->type == EXPR_ACCESS
+				&& object->access.type == ACCESS_INDEX);
+			object = object->access.array;
+		}
+		scan_modified(ctx, object);
+		break;
+	case EXPR_ASSIGN:
+		scan_modified(ctx, expr->assign.object);
+		break;
+	case EXPR_CAST:;
+		const struct type *to = type_dealias(NULL, expr->result);
+		if (to->storage == STORAGE_SLICE
+				|| to->storage == STORAGE_POINTER) {
+			scan_modified(ctx, expr->cast.value);
+		}
+		break;
+	case EXPR_DELETE:;
+		// As does delete to the slice it removes from
+		const struct expression *deleted = expr->delete.expr;
+		if (deleted->type == EXPR_SLICE) {
+			scan_modified(ctx, deleted->slice.object);
+		} else {
+			assert(deleted->type == EXPR_ACCESS
+				&& deleted->access.type == ACCESS_INDEX);
+			scan_modified(ctx, deleted->access.array);
+		}
+		break;
+	case EXPR_LEN:
+		record_header_read(ctx, expr->len.value, HEADER_LENGTH);
+		break;
+	case EXPR_SLICE:
+		if (type_dealias(NULL, expr->slice.object->result)->storage
+				!= STORAGE_SLICE) {
+			scan_modified(ctx, expr->slice.object);
+		}
+		break;
+	case EXPR_UNARITHM:;
+		const struct expression *operand = expr->unarithm.operand;
+		if (expr->unarithm.op == UN_ADDRESS
+				&& operand->type == EXPR_ACCESS
+				&& operand->access.type == ACCESS_IDENTIFIER) {
+			record_addressed(ctx, operand->access.object);
+		} else if (expr->unarithm.op == UN_ADDRESS) {
+			scan_modified(ctx, operand);
+		}
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+static bool
+binding_addressed(struct gen_context *ctx, const struct scope_object *obj)
+{
+	for (size_t i = 0; i < ctx->naddressed; ++i) {
+		if (ctx->addressed[i] == obj) {
+			return true;
+		}
 	}
+	return false;
+}
 
-	struct gen_value lvalue = gen_expr(ctx, expr->binarithm.lvalue);
-	struct gen_value rvalue = gen_expr(ctx, expr->binarithm.rvalue);
-	struct qbe_value qlval = mkqval(ctx, &lvalue);
-	struct qbe_value qrval = mkqval(ctx, &rvalue);
+// Scalar bindings which never have their address taken are kept in QBE
+// temporaries rather than on the stack.
+static bool
+binding_promotable(struct gen_context *ctx, const struct scope_object *obj)
+{
+	if (type_is_aggregate(obj->type)
+			|| type_dealias(NULL, obj->type)->storage == STORAGE_FUNCTION) {
+		return false;
+	}
+	return !binding_addressed(ctx, obj);
+}
 
-	if (bin_extend[expr->assign.op][0]) {
-		qlval = extend(ctx, qlval, ltype);
+// Loads the header fields of a slice or string binding which are read by
+// indexing it or taking its length, if the binding is never written after it
+// is initialized, so that those reads may share one load of each.
+static void
+gen_binding_header(struct gen_context *ctx, struct gen_binding *gb)
+{
+	enum type_storage storage = type_dealias(NULL, gb->object->type)->storage;
+	if ((storage != STORAGE_SLICE && storage != STORAGE_STRING)
+			|| binding_addressed(ctx, gb->object)) {
+		return;
 	}
-	if (bin_extend[expr->assign.op][1]) {
-		qrval = extend(ctx, qrval, rtype);
+	unsigned int fields = 0;
+	for (size_t i = 0; i < ctx->nheaders; ++i) {
+		if (ctx->headers[i].object == gb->object) {
+			fields = ctx->headers[i].fields;
+			break;
+		}
 	}
 
-	assert((ltype->storage == STORAGE_STRING) == (rtype->storage == STORAGE_STRING));
-	if (ltype->storage == STORAGE_STRING) {
-		pushi(ctx->current, &qresult, Q_CALL,
-			&ctx->rt.strcmp, &qlval, &qrval, NULL);
-		if (expr->binarithm.op == BIN_NEQUAL) {
-			struct qbe_value one = constl(1);
-			pushi(ctx->current, &qresult, Q_XOR, &qresult, &one, NULL);
-		} else {
-			assert(expr->binarithm.op == BIN_LEQUAL);
-		}
-		return result;
+	struct qbe_value base = mkqval(ctx, &gb->value);
+	enum qbe_instr load = load_for_type(ctx, &builtin_type_size);
+	if (fields & HEADER_DATA) {
+		gb->data = mkqtmp(ctx, ctx->arch.ptr, "data.%d");
+		pushi(ctx->current, &gb->data, load, &base, NULL);
+	}
+	if (fields & HEADER_LENGTH) {
+		struct qbe_value temp = mkqtmp(ctx, ctx->arch.ptr, ".%d");
+		struct qbe_value offset = constl(builtin_type_size.size);
+		gb->length = mkqtmp(ctx, ctx->arch.sz, "len.%d");
+		pushi(ctx->current, &temp, Q_ADD, &base, &offset, NULL);
+		pushi(ctx->current, &gb->length, load, &temp, NULL);
 	}
-	enum qbe_instr instr = binarithm_for_op(ctx, expr->binarithm.op,
-		expr->binarithm.lvalue->result);
-	pushi(ctx->current, &qresult, instr, &qlval, &qrval, NULL);
-	return result;
 }
 
 static void
@@ -1090,16 +2081,62 @@ gen_expr_binding(struct gen_context *ctx, const struct expression *expr)
 		}
 
 		struct gen_binding *gb = xcalloc(1, sizeof(struct gen_binding));
-		gb->value = mkgtemp(ctx, type, "binding.%d");
 		gb->object = binding->object;
+		if (binding->initializer->type == EXPR_CALL
+				&& binding->initializer->result == type
+				&& type_is_aggregate(type_dealias(NULL, type))) {
+			// qbe gives each call site its own buffer for aggregate
+			// results, which can serve as the binding's storage
+			gb->value = gen_expr(ctx, binding->initializer);
+			gb->value.type = type;
+			gb->next = ctx->bindings;
+			ctx->bindings = gb;
+			gen_binding_header(ctx, gb);
+			continue;
+		}
+
+		const struct expression *init = binding->initializer;
+		while (init->type == EXPR_CAST && init->cast.kind == C_CAST
+				&& init->cast.value->result->size == type->size) {
+			// e.g. the implicit cast of an array literal to a
+			// const-qualified array type
+			const struct type *from =
+				type_dealias(NULL, init->cast.value->result);
+			if (from->storage != type_dealias(NULL, type)->storage
+					|| (from->storage == STORAGE_ARRAY
+						&& from->array.expandable)) {
+				break;
+			}
+			init = init->cast.value;
+		}
+		if (init->type == EXPR_LITERAL && init->result->size == type->size
+				&& literal_templated(init)
+				&& !binding_addressed(ctx, binding->object)) {
+			// Never written to, so the template can serve as the
+			// binding's storage
+			gb->value = gen_template(ctx, init);
+			gb->value.type = type;
+			gb->next = ctx->bindings;
+			ctx->bindings = gb;
+			continue;
+		}
+
+		gb->value = mkgtemp(ctx, type, "binding.%d");
 		gb->next = ctx->bindings;
 		ctx->bindings = gb;
 
-		struct qbe_value qv = mklval(ctx, &gb->value);
-		struct qbe_value sz = constl(type->size);
-		enum qbe_instr alloc = alloc_for_align(type->align);
-		pushprei(ctx->current, &qv, alloc, &sz, NULL);
+		if (binding_promotable(ctx, binding->object)) {
+			gb->value.kind = GV_PROMOTED;
+		} else {
+			struct qbe_value qv = mklval(ctx, &gb->value);
+			struct qbe_value sz = constl(type->size);
+			enum qbe_instr alloc = alloc_for_align(type->align);
+			pushprei(ctx->current, &qv, alloc, &sz, NULL);
+		}
 		gen_expr_at(ctx, binding->initializer, gb->value);
+		if (binding->initializer->result->storage != STORAGE_NEVER) {
+			gen_binding_header(ctx, gb);
+		}
 	}
 	return gv_void;
 }
@@ -1119,30 +2156,27 @@ gen_expr_control(struct gen_context *ctx, const struct expression *expr)
 		}
 	}
 
-	struct gen_scope *deferred = ctx->scope;
-	while (deferred != NULL) {
-		gen_defers(ctx, deferred);
-		if (deferred == scope) {
-			break;
-		}
-		deferred = deferred->parent;
-	}
-
+	struct qbe_value *dest;
 	switch (expr->type) {
 	case EXPR_BREAK:
 		assert(scope->scope->class == SCOPE_LOOP);
-		pushi(ctx->current, NULL, Q_JMP, scope->end, NULL);
+		dest = scope->end;
 		break;
 	case EXPR_CONTINUE:
 		assert(scope->scope->class == SCOPE_LOOP);
-		pushi(ctx->current, NULL, Q_JMP, scope->after, NULL);
+		dest = scope->after;
 		break;
 	case EXPR_YIELD:
-		assert(scope->scope->class == SCOPE_COMPOUND);
-		pushi(ctx->current, NULL, Q_JMP, scope->end, NULL);
+		// Function scopes are yielded to by inlined returns
+		assert(scope->scope->class == SCOPE_COMPOUND
+			|| scope->scope->class == SCOPE_FUNC);
+		dest = scope->end;
 		break;
 	default: abort(); // Invariant
 	}
+	if (!gen_exit(ctx, scope, dest)) {
+		pushi(ctx->current, NULL, Q_JMP, dest, NULL);
+	}
 	return gv_void;
 }
 
@@ -1199,10 +2233,12 @@ gen_expr_call(struct gen_context *ctx, const struct expression *expr)
 	}
 
 	if (rtype->func.result->storage == STORAGE_NEVER) {
+		mark_cold(ctx);
 		for (struct gen_scope *scope = ctx->scope; scope;
 				scope = scope->parent) {
 			gen_defers(ctx, scope);
-			if (scope->scope->class == SCOPE_DEFER) {
+			if (scope->scope->class == SCOPE_DEFER
+					|| scope->scope->class == SCOPE_FUNC) {
 				break;
 			}
 		}
@@ -1392,7 +2428,10 @@ gen_expr_cast_array_at(struct gen_context *ctx,
 	const struct type *typeout = type_dealias(NULL, expr->result);
 	const struct type *typein = type_dealias(NULL, expr->cast.value->result);
 	gen_expr_at(ctx, expr->cast.value, out);
-	if (!typein->array.expandable) {
+	if (!typein->array.expandable
+			|| expr->cast.value->type == EXPR_LITERAL) {
+		// Array literals are filled to the length of out by
+		// gen_literal_array_at
 		return;
 	}
 
@@ -1401,33 +2440,13 @@ gen_expr_cast_array_at(struct gen_context *ctx,
 	assert(typeout->array.length >= typein->array.length);
 
 	const struct type *membtype = typein->array.members;
-	size_t remain = typeout->array.length - typein->array.length;
-
+	struct qbe_value remain =
+		constl(typeout->array.length - typein->array.length);
 	struct qbe_value base = mkqval(ctx, &out);
 	struct qbe_value offs = constl((typein->array.length - 1) * membtype->size);
-	struct gen_value next = mkgtemp(ctx, membtype, ".%d");
-	struct qbe_value ptr = mklval(ctx, &next);
-	struct gen_value item = mkgtemp(ctx, membtype, "item.%d");
-	struct qbe_value qitem = mklval(ctx, &item);
-	pushi(ctx->current, &qitem, Q_ADD, &base, &offs, NULL);
-
-	if (remain * membtype->size <= 128) {
-		struct gen_value last = gen_load(ctx, item);
-		for (size_t n = typein->array.length; n < typeout->array.length; ++n) {
-			struct qbe_value offs = constl(n * membtype->size);
-			pushi(ctx->current, &ptr, Q_ADD, &base, &offs, NULL);
-			gen_store(ctx, next, last);
-		}
-		return;
-	}
-
-	offs = constl(typein->array.length * membtype->size);
-	pushi(ctx->current, &ptr, Q_ADD, &base, &offs, NULL);
-
-	struct qbe_value dtemp = mklval(ctx, &next);
-	struct qbe_value stemp = mklval(ctx, &item);
-	struct qbe_value sz = constl(remain * membtype->size);
-	pushi(ctx->current, NULL, Q_CALL, &ctx->rt.memcpy, &dtemp, &stemp, &sz, NULL);
+	struct qbe_value last = mkqtmp(ctx, ctx->arch.ptr, "item.%d");
+	pushi(ctx->current, &last, Q_ADD, &base, &offs, NULL);
+	gen_fill(ctx, membtype, &last, &remain, -1);
 }
 
 static void
@@ -1767,6 +2786,24 @@ gen_expr_compound_with(struct gen_context *ctx,
 	return gvout;
 }
 
+static void
+gen_literal_template_at(struct gen_context *ctx,
+	const struct expression *expr, struct gen_value out)
+{
+	out.type = expr->result;
+	if (expr->result->size == 0) {
+		return;
+	} else if (literal_is_zero(expr)) {
+		struct qbe_value dest = mklval(ctx, &out);
+		struct qbe_value zero = constl(0);
+		struct qbe_value size = constl(expr->result->size);
+		pushi(ctx->current, NULL, Q_CALL, &ctx->rt.memset,
+			&dest, &zero, &size, NULL);
+		return;
+	}
+	gen_copy_aligned(ctx, out, gen_template(ctx, expr));
+}
+
 static void
 gen_literal_array_at(struct gen_context *ctx,
 	const struct expression *expr,
@@ -1774,56 +2811,95 @@ gen_literal_array_at(struct gen_context *ctx,
 {
 	struct array_literal *aexpr = expr->literal.array;
 	struct qbe_value base = mkqval(ctx, &out);
+	assert(!expr->literal.packed); // See literal_templated
 
 	size_t n = 0;
 	const struct type *atype = type_dealias(NULL, expr->result);
+	size_t length = atype->array.length;
+	if (atype->array.expandable) {
+		assert(out.type);
+		length = type_dealias(NULL, out.type)->array.length;
+	}
 	size_t msize = atype->array.members->size;
 	struct gen_value item = mkgtemp(ctx, atype->array.members, "item.%d");
 	struct qbe_value ptr;
-	for (const struct array_literal *ac = aexpr; ac; ac = ac->next) {
+	for (const struct array_literal *ac = aexpr; ac && n < length;
+			ac = ac->next) {
 		struct qbe_value offs = constl(n * msize);
 		ptr = mklval(ctx, &item);
 		pushi(ctx->current, &ptr, Q_ADD, &base, &offs, NULL);
 		gen_expr_at(ctx, ac->value, item);
 		++n;
 	}
-	assert(n == atype->array.length);
-	if (!atype->array.expandable || n == 0) {
-		return;
-	}
-	assert(out.type);
-	const struct type_array arr = type_dealias(NULL, out.type)->array;
-	if (arr.length <= n) {
+	// Evaluated literals (see literal_default) may list fewer members than
+	// their length, in which case the last one is repeated as it is for
+	// expandable arrays
+	if (n == 0 || length <= n) {
 		return;
 	}
 
-	struct qbe_value nsize = constl(n * msize);
-	struct qbe_value next = mkqtmp(ctx, ctx->arch.ptr, ".%d");
-	pushi(ctx->current, &next, Q_ADD, &base, &nsize, NULL);
-
-	struct qbe_value qlen = constl((arr.length - n) * msize);
-	pushi(ctx->current, NULL, Q_CALL, &ctx->rt.memcpy, &next, &ptr, &qlen, NULL);
+	struct qbe_value remain = constl(length - n);
+	gen_fill(ctx, atype->array.members, &ptr, &remain,
+		expandable_byte(expr));
 }
 
-static struct qbe_data_item *gen_data_item(struct gen_context *,
-	const struct expression *, struct qbe_data_item *);
+static struct gen_strlit *
+intern_string(struct gen_context *ctx, const char *value, size_t len)
+{
+	uint32_t hash = FNV1A_INIT;
+	for (size_t i = 0; i < len; ++i) {
+		hash = fnv1a(hash, value[i]);
+	}
+	struct gen_strlit **next = &ctx->strings[hash % STRLIT_BUCKETS];
+	for (; *next; next = &(*next)->next) {
+		if ((*next)->len == len && (len == 0
+				|| memcmp((*next)->value, value, len) == 0)) {
+			return *next;
+		}
+	}
+
+	struct gen_strlit *lit = *next = xcalloc(1, sizeof(struct gen_strlit));
+	lit->len = len;
+	if (len == 0) {
+		return lit;
+	}
+	struct qbe_def *def = xcalloc(1, sizeof(struct qbe_def));
+	def->name = gen_name(&ctx->id, "strdata.%d");
+	def->kind = Q_DATA;
+	def->data.align = ALIGN_UNDEFINED;
+	def->data.readonly = true;
+	def->data.items.type = QD_STRING;
+	def->data.items.str = xcalloc(len, 1);
+	def->data.items.sz = len;
+	memcpy(def->data.items.str, value, len);
+	qbe_append_def(ctx->out, def);
+	lit->value = def->data.items.str;
+	lit->data = def->name;
+	return lit;
+}
 
 static struct gen_value
 gen_literal_string(struct gen_context *ctx, const struct expression *expr)
 {
-	struct qbe_def *str = xcalloc(1, sizeof(struct qbe_def));
-	str->kind = Q_DATA;
-	str->data.align = ALIGN_UNDEFINED;
-	str->exported = false;
-	str->name = gen_name(&ctx->id, "strliteral.%d");
-	str->file = expr->loc.file;
-	gen_data_item(ctx, expr, &str->data.items);
-	qbe_append_def(ctx->out, str);
+	struct gen_strlit *lit = intern_string(ctx,
+		expr->literal.string.value, expr->literal.string.len);
+	if (!lit->header) {
+		struct qbe_def *str = xcalloc(1, sizeof(struct qbe_def));
+		str->kind = Q_DATA;
+		str->data.align = ALIGN_UNDEFINED;
+		str->data.readonly = true;
+		str->exported = false;
+		str->name = gen_name(&ctx->id, "strliteral.%d");
+		str->file = expr->loc.file;
+		gen_data_item(ctx, expr, &str->data.items);
+		qbe_append_def(ctx->out, str);
+		lit->header = str->name;
+	}
 
 	return (struct gen_value){
 		.kind = GV_GLOBAL,
 		.type = expr->result,
-		.name = xstrdup(str->name),
+		.name = xstrdup(lit->header),
 	};
 }
 
@@ -1897,6 +2973,11 @@ gen_expr_literal_at(struct gen_context *ctx,
 		return;
 	}
 
+	if (literal_templated(expr)) {
+		gen_literal_template_at(ctx, expr, out);
+		return;
+	}
+
 	switch (type_dealias(NULL, expr->result)->storage) {
 	case STORAGE_ARRAY:
 		gen_literal_array_at(ctx, expr, out);
@@ -2082,9 +3163,36 @@ gen_expr_delete(struct gen_context *ctx, const struct expression *expr)
 	pushi(ctx->current, NULL, store, &qlen, &qlenptr, NULL);
 
 	if (!expr->delete.is_static) {
+		// Shrink the slice only if unensure would: if less than half of
+		// its capacity is still in use, or if its capacity is odd, in
+		// which case it is rounded down to an even size
+		struct qbe_value qcap = mkqtmp(ctx, ctx->arch.sz, ".%d");
+		offset = constl(builtin_type_size.size * 2);
+		pushi(ctx->current, &qcap, Q_ADD, &qobj, &offset, NULL);
+		pushi(ctx->current, &qcap, load, &qcap, NULL);
+		struct qbe_value used = mkqtmp(ctx, ctx->arch.sz, ".%d");
+		pushi(ctx->current, &used, Q_ADD, &qlen, &qlen, NULL);
+		struct qbe_value odd = mkqtmp(ctx, ctx->arch.sz, ".%d");
+		struct qbe_value one = constl(1);
+		pushi(ctx->current, &odd, Q_AND, &qcap, &one, NULL);
+
+		struct qbe_statement lshrink, lkeep;
+		struct qbe_value bshrink = mklabel(ctx, &lshrink, ".%d");
+		struct qbe_value bkeep = mklabel(ctx, &lkeep, ".%d");
+		struct qbe_value shrink = mkqtmp(ctx, &qbe_word, ".%d");
+		struct qbe_value isodd = mkqtmp(ctx, &qbe_word, ".%d");
+		struct qbe_value zero = constl(0);
+		pushi(ctx->current, &shrink, Q_CUGTL, &qcap, &used, NULL);
+		pushi(ctx->current, &isodd, Q_CNEL, &odd, &zero, NULL);
+		pushi(ctx->current, &shrink, Q_OR, &shrink, &isodd, NULL);
+		pushi(ctx->current, NULL, Q_JNZ, &shrink, &bshrink, &bkeep, NULL);
+
+		push(&ctx->current->body, &lshrink);
+		mark_cold(ctx);
 		qobj = mklval(ctx, &object);
 		pushi(ctx->current, NULL, Q_CALL, &ctx->rt.unensure, &qobj, &membsz,
 			NULL);
+		push(&ctx->current->body, &lkeep);
 	}
 
 	return gv_void;
@@ -2273,26 +3381,28 @@ gen_expr_append_insert(struct gen_context *ctx, const struct expression *expr)
 	struct qbe_value ptr = mkqtmp(ctx, ctx->arch.ptr, ".%d");
 	const struct type *mtype = type_dealias(NULL, slice.type)->array.members;
 	struct qbe_value membsz = constl(mtype->size);
+	offs = constl(builtin_type_size.size * 2);
+	pushi(ctx->current, &ptr, Q_ADD, &qslice, &offs, NULL);
+	struct qbe_value cap = mkqtmp(ctx, ctx->arch.sz, ".%d");
+	pushi(ctx->current, &cap, load, &ptr, NULL);
+
+	struct qbe_statement lvalid, linvalid;
+	struct qbe_value bvalid = mklabel(ctx, &lvalid, ".%d");
+	struct qbe_value binvalid = mklabel(ctx, &linvalid, ".%d");
+	struct qbe_value valid = mkqtmp(ctx, &qbe_word, ".%d");
+	pushi(ctx->current, &valid, Q_CULEL, &newlen, &cap, NULL);
+	pushi(ctx->current, NULL, Q_JNZ, &valid, &bvalid, &binvalid, NULL);
+
+	push(&ctx->current->body, &linvalid);
 	if (!expr->append.is_static) {
+		// Only reached when the slice has to grow
+		mark_cold(ctx);
 		struct qbe_value lval = mklval(ctx, &slice);
 		pushi(ctx->current, NULL, Q_CALL, &ctx->rt.ensure, &lval, &membsz, NULL);
 	} else {
-		offs = constl(builtin_type_size.size * 2);
-		pushi(ctx->current, &ptr, Q_ADD, &qslice, &offs, NULL);
-		struct qbe_value cap = mkqtmp(ctx, ctx->arch.ptr, ".%d");
-		pushi(ctx->current, &cap, load, &ptr, NULL);
-
-		struct qbe_statement lvalid, linvalid;
-		struct qbe_value bvalid = mklabel(ctx, &lvalid, ".%d");
-		struct qbe_value binvalid = mklabel(ctx, &linvalid, ".%d");
-		struct qbe_value valid = mkqtmp(ctx, &qbe_word, ".%d");
-		pushi(ctx->current, &valid, Q_CULEL, &newlen, &cap, NULL);
-		pushi(ctx->current, NULL, Q_JNZ, &valid, &bvalid, &binvalid, NULL);
-
-		push(&ctx->current->body, &linvalid);
 		gen_fixed_abort(ctx, expr->loc, ABORT_OOB);
-		push(&ctx->current->body, &lvalid);
 	}
+	push(&ctx->current->body, &lvalid);
 
 	struct qbe_value base = mkqtmp(ctx, ctx->arch.ptr, ".%d");
 	pushi(ctx->current, &base, load, &qslice, NULL);
@@ -2334,18 +3444,15 @@ gen_expr_append_insert(struct gen_context *ctx, const struct expression *expr)
 		gen_expr_at(ctx, expr->append.value, item);
 
 		assert(valtype->array.length != SIZE_UNDEFINED);
-		struct qbe_value next = mkqtmp(ctx, ctx->arch.ptr, "next.%d");
 		struct qbe_value last = mkqtmp(ctx, ctx->arch.ptr, "last.%d");
-		struct qbe_value arlen = constl(valtype->array.length * mtype->size);
-		pushi(ctx->current, &next, Q_ADD, &ptr, &arlen, NULL);
-		arlen = constl((valtype->array.length - 1) * mtype->size);
+		struct qbe_value arlen = constl((valtype->array.length - 1) * mtype->size);
 		pushi(ctx->current, &last, Q_ADD, &ptr, &arlen, NULL);
 
-		struct qbe_value remain = mkqtmp(ctx, ctx->arch.ptr, ".%d");
+		struct qbe_value remain = mkqtmp(ctx, ctx->arch.sz, ".%d");
 		struct qbe_value one = constl(1);
 		pushi(ctx->current, &remain, Q_SUB, &appendlen, &one, NULL);
-		pushi(ctx->current, &remain, Q_MUL, &remain, &membsz, NULL);
-		pushi(ctx->current, NULL, Q_CALL, &ctx->rt.memcpy, &next, &last, &remain, NULL);
+		gen_fill(ctx, mtype, &last, &remain,
+			expandable_byte(expr->append.value));
 	} else {
 		gen_store(ctx, item, value);
 	}
@@ -2486,6 +3593,24 @@ gen_subset_match_tests(struct gen_context *ctx,
 	return match;
 }
 
+// Returns true if the storage of a match object can't change while a case
+// binding refers to it in place: it is either the result of a call, or a
+// binding which is never written to after it is initialized.
+static bool
+match_object_stable(struct gen_context *ctx, const struct expression *value)
+{
+	switch (value->type) {
+	case EXPR_CALL:
+		return true;
+	case EXPR_ACCESS:
+		return value->access.type == ACCESS_IDENTIFIER
+			&& value->access.object->otype == O_BIND
+			&& !binding_addressed(ctx, value->access.object);
+	default:
+		return false;
+	}
+}
+
 static struct gen_value
 gen_match_with_tagged(struct gen_context *ctx,
 	const struct expression *expr,
@@ -2501,6 +3626,7 @@ gen_match_with_tagged(struct gen_context *ctx,
 	struct qbe_value qobject = mkqval(ctx, &object);
 	struct qbe_value tag = mkqtmp(ctx, ctx->arch.sz, "tag.%d");
 	gen_load_tag(ctx, &tag, &qobject, objtype);
+	bool stable = match_object_stable(ctx, expr->match.value);
 
 	struct qbe_statement lout;
 	struct qbe_value bout = mklabel(ctx, &lout, ".%d");
@@ -2532,6 +3658,9 @@ gen_match_with_tagged(struct gen_context *ctx,
 		}
 
 		push(&ctx->current->body, &lmatch);
+		if (type_has_error(NULL, _case->type)) {
+			mark_cold(ctx);
+		}
 
 		if (!_case->object || _case->type->size == 0) {
 			goto next;
@@ -2544,6 +3673,21 @@ gen_match_with_tagged(struct gen_context *ctx,
 		ctx->bindings = gb;
 
 		struct qbe_value qv = mklval(ctx, &gb->value);
+		if (stable && type_is_aggregate(type_dealias(NULL, _case->type))
+				&& !binding_addressed(ctx, _case->object)) {
+			// Neither the binding nor the object is written to, so
+			// the binding can refer to the object in place
+			if (compat == COMPAT_SUBTYPE) {
+				struct qbe_value offset = nested_tagged_offset(
+					object.type, _case->type);
+				pushi(ctx->current, &qv, Q_ADD,
+					&qobject, &offset, NULL);
+			} else {
+				pushi(ctx->current, &qv, Q_COPY, &qobject, NULL);
+			}
+			goto next;
+		}
+
 		enum qbe_instr alloc = alloc_for_align(_case->type->align);
 		struct qbe_value sz = constl(_case->type->size);
 		pushprei(ctx->current, &qv, alloc, &sz, NULL);
@@ -2711,7 +3855,15 @@ gen_expr_len(struct gen_context *ctx, const struct expression *expr)
 			.lval = len,
 		};
 	case STORAGE_SLICE:
-	case STORAGE_STRING:
+	case STORAGE_STRING:;
+		const struct gen_binding *cached = cached_header(ctx, value);
+		if (cached && cached->length.type) {
+			temp = mkgtemp(ctx, &builtin_type_size, ".%d");
+			struct qbe_value qtemp = mkqval(ctx, &temp);
+			pushi(ctx->current, &qtemp, Q_COPY,
+				&cached->length, NULL);
+			return temp;
+		}
 		gv = gen_expr(ctx, value);
 		gv = gen_autoderef(ctx, gv);
 		temp = mkgtemp(ctx, &builtin_type_size, ".%d");
@@ -2735,10 +3887,14 @@ gen_expr_return(struct gen_context *ctx, const struct expression *expr)
 	if (expr->_return.value->result->storage == STORAGE_NEVER) {
 		return gv_void;
 	}
-	for (struct gen_scope *scope = ctx->scope; scope; scope = scope->parent) {
-		gen_defers(ctx, scope);
-	}
-	if (ret.type->size == 0) {
+	if (exit_defers(ctx, NULL)) {
+		if (!ctx->bret.name) {
+			ctx->bret = mklabel(ctx, &ctx->retl, "return.%d");
+			ctx->retval = mkgtemp(ctx, ret.type, "return.%d");
+		}
+		branch_copyresult(ctx, ret, ctx->retval, NULL);
+		gen_exit(ctx, NULL, &ctx->bret);
+	} else if (ret.type->size == 0) {
 		pushi(ctx->current, NULL, Q_RET, NULL);
 	} else {
 		struct qbe_value qret = mkqval(ctx, &ret);
@@ -3051,6 +4207,7 @@ gen_expr_unarithm(struct gen_context *ctx,
 	case UN_ADDRESS:
 		if (operand->type == EXPR_ACCESS) {
 			val = gen_expr_access_addr(ctx, operand);
+			assert(val.kind != GV_PROMOTED); // See scan_addressed
 			val.type = expr->result;
 			return val;
 		}
@@ -3298,6 +4455,159 @@ gen_expr_with(struct gen_context *ctx,
 	return gen_expr(ctx, expr);
 }
 
+struct layout_block {
+	// Statements [start, end) of the function body
+	size_t start, end;
+	bool hot;
+};
+
+static const struct qbe_statement *
+block_terminator(const struct qbe_statements *body,
+	const struct layout_block *block)
+{
+	for (size_t i = block->end; i > block->start; --i) {
+		const struct qbe_statement *stmt = &body->stmts[i - 1];
+		if (stmt->type == Q_COMMENT) {
+			continue;
+		}
+		if (stmt->type != Q_INSTR) {
+			return NULL;
+		}
+		switch (stmt->instr) {
+		case Q_HLT:
+		case Q_JMP:
+		case Q_JNZ:
+		case Q_RET:
+			return stmt;
+		default:
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+static size_t
+lookup_block(const struct qbe_statements *body,
+	const struct layout_block *blocks, const size_t *buckets,
+	size_t nbuckets, const char *label)
+{
+	uint32_t hash = fnv1a_s(FNV1A_INIT, label);
+	for (size_t i = hash & (nbuckets - 1); buckets[i] != 0;
+			i = (i + 1) & (nbuckets - 1)) {
+		const struct layout_block *block = &blocks[buckets[i] - 1];
+		if (strcmp(body->stmts[block->start].label, label) == 0) {
+			return buckets[i] - 1;
+		}
+	}
+	abort(); // Invariant
+}
+
+// Moves cold blocks, and any blocks which can only be reached through them, to
+// the end of the function. The likely path through the function is then laid
+// out contiguously, and its conditional branches fall through.
+static void
+gen_layout(struct gen_context *ctx)
+{
+	struct qbe_statements body = ctx->current->body;
+	bool cold = false;
+	size_t nblocks = 1;
+	for (size_t i = 1; i < body.ln; ++i) {
+		if (body.stmts[i].type == Q_LABEL) {
+			cold = cold || body.stmts[i].cold;
+			++nblocks;
+		}
+	}
+	if (!cold) {
+		return;
+	}
+
+	// The entry block may not start with a label, and is never moved
+	struct layout_block *blocks = xcalloc(nblocks, sizeof(blocks[0]));
+	size_t nbuckets = 1;
+	while (nbuckets < nblocks * 2) {
+		nbuckets *= 2;
+	}
+	size_t *buckets = xcalloc(nbuckets, sizeof(buckets[0]));
+	for (size_t i = 0, b = 0; i < body.ln; ++i) {
+		if (i != 0 && body.stmts[i].type == Q_LABEL) {
+			blocks[b++].end = i;
+			blocks[b].start = i;
+		}
+		if (body.stmts[i].type == Q_LABEL) {
+			uint32_t hash = fnv1a_s(FNV1A_INIT, body.stmts[i].label);
+			size_t j = hash & (nbuckets - 1);
+			while (buckets[j] != 0) {
+				j = (j + 1) & (nbuckets - 1);
+			}
+			buckets[j] = b + 1;
+		}
+	}
+	blocks[nblocks - 1].end = body.ln;
+
+	// Hot blocks are those reachable from the entry without passing
+	// through a cold one
+	size_t *stack = xcalloc(nblocks, sizeof(stack[0]));
+	size_t depth = 0;
+	blocks[0].hot = true;
+	stack[depth++] = 0;
+	while (depth != 0) {
+		size_t b = stack[--depth];
+		size_t succ[2], nsucc = 0;
+		const struct qbe_statement *term =
+			block_terminator(&body, &blocks[b]);
+		if (!term) {
+			if (b + 1 < nblocks) {
+				succ[nsucc++] = b + 1;
+			}
+		} else if (term->instr == Q_JMP || term->instr == Q_JNZ) {
+			struct qbe_arguments *arg = term->args;
+			if (term->instr == Q_JNZ) {
+				arg = arg->next;
+			}
+			for (; arg; arg = arg->next) {
+				succ[nsucc++] = lookup_block(&body, blocks,
+					buckets, nbuckets, arg->value.name);
+			}
+		}
+		for (size_t i = 0; i < nsucc; ++i) {
+			struct layout_block *next = &blocks[succ[i]];
+			if (!next->hot && !body.stmts[next->start].cold) {
+				next->hot = true;
+				stack[depth++] = succ[i];
+			}
+		}
+	}
+
+	ctx->current->body = (struct qbe_statements){0};
+	for (int pass = 0; pass < 2; ++pass) {
+		bool hot = pass == 0;
+		for (size_t b = 0; b < nblocks; ++b) {
+			if (blocks[b].hot != hot) {
+				continue;
+			}
+			for (size_t i = blocks[b].start; i < blocks[b].end; ++i) {
+				push(&ctx->current->body, &body.stmts[i]);
+			}
+			// Blocks which fell through to one which is now
+			// elsewhere have to jump to it instead
+			if (b + 1 < nblocks && blocks[b + 1].hot != hot
+					&& !block_terminator(&body, &blocks[b])) {
+				struct qbe_value next = {
+					.kind = QV_LABEL,
+					.name = xstrdup(body.stmts[
+						blocks[b + 1].start].label),
+				};
+				pushi(ctx->current, NULL, Q_JMP, &next, NULL);
+			}
+		}
+	}
+
+	free(body.stmts);
+	free(blocks);
+	free(buckets);
+	free(stack);
+}
+
 static void
 gen_function_decl(struct gen_context *ctx, const struct declaration *decl)
 {
@@ -3331,6 +4641,12 @@ gen_function_decl(struct gen_context *ctx, const struct declaration *decl)
 		qdef->func.variadic = true;
 	}
 
+	ctx->naddressed = 0;
+	ctx->nheaders = 0;
+	struct expression *body = decl->func.body;
+	scan_addressed(&body, ctx);
+	expr_walk(body, scan_addressed, ctx);
+
 	struct qbe_func_param *param, **next = &qdef->func.params;
 	for (struct scope_object *obj = decl->func.scope->objects;
 			obj; obj = obj->lnext) {
@@ -3351,13 +4667,18 @@ gen_function_decl(struct gen_context *ctx, const struct declaration *decl)
 		if (type_is_aggregate(type)) {
 			// No need to copy to stack
 			gb->value.name = xstrdup(param->name);
+			gen_binding_header(ctx, gb);
 		} else {
 			gb->value.name = gen_name(&ctx->id, "param.%d");
 
-			struct qbe_value qv = mklval(ctx, &gb->value);
-			struct qbe_value sz = constl(type->size);
-			enum qbe_instr alloc = alloc_for_align(type->align);
-			pushprei(ctx->current, &qv, alloc, &sz, NULL);
+			if (binding_promotable(ctx, obj)) {
+				gb->value.kind = GV_PROMOTED;
+			} else {
+				struct qbe_value qv = mklval(ctx, &gb->value);
+				struct qbe_value sz = constl(type->size);
+				enum qbe_instr alloc = alloc_for_align(type->align);
+				pushprei(ctx->current, &qv, alloc, &sz, NULL);
+			}
 			struct gen_value src = {
 				.kind = GV_TEMP,
 				.type = type,
@@ -3391,6 +4712,9 @@ gen_function_decl(struct gen_context *ctx, const struct declaration *decl)
 	} else {
 		pushi(ctx->current, NULL, Q_RET, NULL);
 	}
+	gen_exits_tail(ctx);
+	gen_abort_tail(ctx);
+	gen_layout(ctx);
 
 	qbe_append_def(ctx->out, qdef);
 
@@ -3479,6 +4803,50 @@ gen_function_decl(struct gen_context *ctx, const struct declaration *decl)
 	ctx->current = NULL;
 }
 
+// Zeroes in packed data are emitted as a run once there are this many
+#define ZERO_RUN_MIN 16
+
+// Emits packed array members, starting in item, as strings and runs of zeroes.
+// Returns the last item emitted.
+static struct qbe_data_item *
+gen_data_packed(const struct packed_literal *packed, struct qbe_data_item *item)
+{
+	const char *data = packed->data;
+	bool first = true;
+	size_t start = 0;
+	for (size_t i = 0; i <= packed->len; ++i) {
+		size_t end = i;
+		while (end < packed->len && data[end] == 0) {
+			++end;
+		}
+		if (end - i < ZERO_RUN_MIN && end < packed->len) {
+			i = end;
+			continue;
+		}
+		if (i > start) {
+			if (!first) {
+				item = item->next =
+					xcalloc(1, sizeof(struct qbe_data_item));
+			}
+			first = false;
+			item->type = QD_STRING;
+			item->str = (char *)&data[start];
+			item->sz = i - start;
+		}
+		if (end > i) {
+			if (!first) {
+				item = item->next =
+					xcalloc(1, sizeof(struct qbe_data_item));
+			}
+			first = false;
+			item->type = QD_ZEROED;
+			item->zeroed = end - i;
+		}
+		start = i = end;
+	}
+	return item;
+}
+
 static struct qbe_data_item *
 gen_data_item(struct gen_context *ctx, const struct expression *expr,
 	struct qbe_data_item *item)
@@ -3491,7 +4859,13 @@ gen_data_item(struct gen_context *ctx, const struct expression *expr,
 	if (type->storage == STORAGE_ENUM) {
 		type = type->alias.type;
 	}
-	type = lower_flexible(NULL, type, NULL);
+	if (type_is_flexible(type)) {
+		// Members of evaluated array literals may all share a stale
+		// flexible type. It only needs to be lowered once.
+		const struct type *flexible = type;
+		type = lower_flexible(NULL, type, NULL);
+		flexible_reset_refs(flexible);
+	}
 	if (literal->object) {
 		item->type = QD_SYMOFFS;
 		item->sym = ident_to_sym(&literal->object->ident);
@@ -3551,36 +4925,54 @@ gen_data_item(struct gen_context *ctx, const struct expression *expr,
 		break;
 	case STORAGE_ARRAY:
 		assert(type->array.length != SIZE_UNDEFINED);
-		size_t n = type->array.length;
+		if (literal->packed && literal->packed->len != 0) {
+			item = gen_data_packed(literal->packed, item);
+			break;
+		}
+		// Consecutive zero members are emitted as one run
+		size_t n = type->array.length, zeroes = 0;
+		bool first = true;
 		for (struct array_literal *c = literal->array;
 				c && n; c = c->next ? c->next : c, --n) {
+			if (literal_is_zero(c->value)) {
+				zeroes += c->value->result->size;
+				continue;
+			}
+			if (zeroes != 0) {
+				if (!first) {
+					item = item->next = xcalloc(1,
+						sizeof(struct qbe_data_item));
+				}
+				first = false;
+				item->type = QD_ZEROED;
+				item->zeroed = zeroes;
+				zeroes = 0;
+			}
+			if (!first) {
+				item = item->next = xcalloc(1,
+					sizeof(struct qbe_data_item));
+			}
+			first = false;
 			item = gen_data_item(ctx, c->value, item);
-			if (n > 1 || c->next) {
-				item->next = xcalloc(1,
+		}
+		if (zeroes != 0) {
+			if (!first) {
+				item = item->next = xcalloc(1,
 					sizeof(struct qbe_data_item));
-				item = item->next;
 			}
+			item->type = QD_ZEROED;
+			item->zeroed = zeroes;
 		}
 		break;
-	case STORAGE_STRING:
-		def = xcalloc(1, sizeof(struct qbe_def));
-		def->name = gen_name(&ctx->id, "strdata.%d");
-		def->kind = Q_DATA;
-		def->data.align = ALIGN_UNDEFINED;
-		def->data.items.type = QD_STRING;
-		def->data.items.str = xcalloc(expr->literal.string.len, 1);
-		def->data.items.sz = expr->literal.string.len;
-		memcpy(def->data.items.str, expr->literal.string.value,
-			expr->literal.string.len);
-
+	case STORAGE_STRING:;
+		struct gen_strlit *lit = intern_string(ctx,
+			expr->literal.string.value, expr->literal.string.len);
 		item->type = QD_VALUE;
-		if (expr->literal.string.len != 0) {
-			qbe_append_def(ctx->out, def);
+		if (lit->data) {
 			item->value.kind = QV_GLOBAL;
 			item->value.type = &qbe_long;
-			item->value.name = xstrdup(def->name);
+			item->value.name = xstrdup(lit->data);
 		} else {
-			free(def);
 			item->value = constl(0);
 		}
 
@@ -3611,6 +5003,11 @@ gen_data_item(struct gen_context *ctx, const struct expression *expr,
 			}
 			++len;
 		}
+		if (literal->packed && literal->packed->len != 0) {
+			subitem = gen_data_packed(literal->packed, subitem);
+			len = literal->packed->len
+				/ type->array.members->size;
+		}
 
 		item->type = QD_VALUE;
 		if (len != 0) {
@@ -3632,77 +5029,83 @@ gen_data_item(struct gen_context *ctx, const struct expression *expr,
 		item->type = QD_VALUE;
 		item->value = constl(len);
 		break;
-	case STORAGE_STRUCT:
+	case STORAGE_STRUCT:;
+		// Zero-sized fields may share an offset with the next field, so
+		// padding is computed from the end of the data emitted so far
+		size_t end = 0;
 		for (struct struct_literal *f = literal->_struct;
 				f; f = f->next) {
-			if (f->field->type->size != 0) {
+			const struct struct_field *f1 = f->field;
+			if (f1->type->size != 0) {
 				item = gen_data_item(ctx, f->value, item);
+				end = f1->offset + f1->type->size;
 			}
 			if (f->next) {
-				const struct struct_field *f1 = f->field;
 				const struct struct_field *f2 = f->next->field;
-				if (f2->offset > f1->offset + f1->type->size) {
+				// Zero-sized fields leave the current item to the
+				// next field, unless padding follows them
+				bool padded = false;
+				if (f2->offset > end) {
 					item->next = xcalloc(1,
 						sizeof(struct qbe_data_item));
 					item = item->next;
 					item->type = QD_ZEROED;
-					item->zeroed = f2->offset -
-						(f1->offset + f1->type->size);
+					item->zeroed = f2->offset - end;
+					end = f2->offset;
+					padded = true;
 				}
 
-				if (f->field->type->size != 0) {
-					item->next = xcalloc(1,
-						sizeof(struct qbe_data_item));
-					item = item->next;
-				}
-			} else {
-				const struct struct_field *fi = f->field;
-				if (fi->offset + fi->type->size
-						!= expr->result->size) {
+				if (f1->type->size != 0 || padded) {
 					item->next = xcalloc(1,
 						sizeof(struct qbe_data_item));
 					item = item->next;
-					item->type = QD_ZEROED;
-					item->zeroed = expr->result->size
-						- (fi->offset + fi->type->size);
 				}
+			} else if (end != expr->result->size) {
+				item->next = xcalloc(1,
+					sizeof(struct qbe_data_item));
+				item = item->next;
+				item->type = QD_ZEROED;
+				item->zeroed = expr->result->size - end;
 			}
 		}
 		break;
-	case STORAGE_TUPLE:
+	case STORAGE_TUPLE:;
+		// As with structs, zero-sized members may be placed before the
+		// end of the member preceding them
+		end = 0;
 		for (const struct tuple_literal *tuple = literal->tuple;
 				tuple; tuple = tuple->next) {
-			if (tuple->field->type->size != 0) {
+			const struct type_tuple *f1 = tuple->field;
+			if (f1->type->size != 0) {
 				item = gen_data_item(ctx, tuple->value, item);
+				end = f1->offset + f1->type->size;
 			}
 			if (tuple->next) {
-				const struct type_tuple *f1 = tuple->field;
 				const struct type_tuple *f2 = tuple->next->field;
-				if (f2->offset > f1->offset + f1->type->size) {
+				// Zero-sized fields leave the current item to the
+				// next field, unless padding follows them
+				bool padded = false;
+				if (f2->offset > end) {
 					item->next = xcalloc(1,
 						sizeof(struct qbe_data_item));
 					item = item->next;
 					item->type = QD_ZEROED;
-					item->zeroed = f2->offset -
-						(f1->offset + f1->type->size);
+					item->zeroed = f2->offset - end;
+					end = f2->offset;
+					padded = true;
 				}
 
-				if (tuple->field->type->size != 0) {
-					item->next = xcalloc(1,
-						sizeof(struct qbe_data_item));
-					item = item->next;
-				}
-			} else {
-				const struct type_tuple *fi = tuple->field;
-				if (fi->offset + fi->type->size
-						!= expr->result->size) {
+				if (f1->type->size != 0 || padded) {
 					item->next = xcalloc(1,
 						sizeof(struct qbe_data_item));
 					item = item->next;
-					item->type = QD_ZEROED;
-					item->zeroed = expr->result->size
-						- (fi->offset + fi->type->size);
 				}
+			} else if (end != expr->result->size) {
+				item->next = xcalloc(1,
+					sizeof(struct qbe_data_item));
+				item = item->next;
+				item->type = QD_ZEROED;
+				item->zeroed = expr->result->size - end;
 			}
 		}
 		break;
@@ -1,3 +1,4 @@
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,6 +22,7 @@ rtfunc_init(struct gen_context *ctx)
 {
 	ctx->rt = (struct rt){
 		.abort = mkrtfunc(ctx, "rt.abort"),
+		.calloc = mkrtfunc(ctx, "rt.calloc"),
 		.ensure = mkrtfunc(ctx, "rt.ensure"),
 		.fixedabort = mkrtfunc(ctx, "rt.abort_fixed"),
 		.free = mkrtfunc(ctx, "rt.free"),
@@ -48,6 +50,7 @@ mkval(const struct gen_value *value, const struct qbe_type *type)
 		qval.threadlocal = value->threadlocal;
 		break;
 	case GV_TEMP:
+	case GV_PROMOTED:
 		qval.kind = QV_TEMPORARY;
 		qval.name = value->name;
 		break;
@@ -65,6 +68,7 @@ mkqval(struct gen_context *ctx, const struct gen_value *value)
 struct qbe_value
 mklval(struct gen_context *ctx, const struct gen_value *value)
 {
+	assert(value->kind != GV_PROMOTED); // Has no address
 	return mkval(value, ctx->arch.ptr);
 }
 
@@ -105,6 +109,7 @@ mklabel(struct gen_context *ctx, struct qbe_statement *stmt, const char *fmt)
 	snprintf(l, n + 1, fmt, ctx->id);
 
 	stmt->label = l;
+	stmt->cold = false;
 	stmt->type = Q_LABEL;
 	ctx->id++;
 	return (struct qbe_value){
@@ -0,0 +1,294 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "expr.h"
+#include "identifier.h"
+#include "opt.h"
+#include "scope.h"
+#include "types.h"
+#include "util.h"
+
+// Function inlining
+//
+// Calls to small leaf functions defined in this unit, or exported with their
+// bodies in an imported module's typedefs, are replaced with a copy of the
+// callee's body, in a compound which uses the callee's function scope. Each
+// return in the body becomes a yield to it, which runs the callee's defers just
+// as the return would have. Gen stops at the function scope when running
+// defers for an abort, so the caller's defers are left alone. The arguments are
+// evaluated and bound to the callee's parameters before it, in a compound of
+// their own, so an abort while evaluating them still runs the caller's defers.
+//
+// Only leaf functions (which make no calls) are inlined, so a function is never
+// inlined into itself.
+
+struct inline_candidate {
+	const struct declaration *decl;
+	struct inline_candidate *next;
+};
+
+struct inline_scan {
+	size_t nodes;
+	bool eligible, returns;
+};
+
+static bool
+scan_body(struct expression **slot, void *user)
+{
+	struct inline_scan *scan = user;
+	const struct expression *expr = *slot;
+	++scan->nodes;
+	switch (expr->type) {
+	case EXPR_BINDING:
+		// Static bindings would be duplicated by each copy
+		for (const struct expression_binding *binding = &expr->binding;
+				binding; binding = binding->next) {
+			if (binding->unpack
+					&& binding->unpack->object->otype == O_DECL) {
+				scan->eligible = false;
+			} else if (!binding->unpack
+					&& binding->object->otype == O_DECL) {
+				scan->eligible = false;
+			}
+		}
+		break;
+	case EXPR_RETURN:
+		scan->returns = true;
+		break;
+	case EXPR_CALL:
+	case EXPR_VAARG:
+	case EXPR_VAEND:
+	case EXPR_VASTART:
+		scan->eligible = false;
+		break;
+	default:
+		break;
+	}
+	return scan->eligible;
+}
+
+static bool
+inlinable(const struct declaration *decl, int level)
+{
+	if (decl->decl_type != DECL_FUNC || !decl->func.body) {
+		return false;
+	}
+	const struct type *fntype = decl->func.type;
+	if (fntype->func.variadism != VARIADISM_NONE
+			|| fntype->func.result->storage == STORAGE_NEVER) {
+		return false;
+	}
+	for (const struct scope_object *obj = decl->func.scope->objects;
+			obj; obj = obj->lnext) {
+		if (obj->type->size == 0) {
+			return false;
+		}
+	}
+
+	struct inline_scan scan = { .eligible = true };
+	struct expression *body = decl->func.body;
+	if (scan_body(&body, &scan)) {
+		expr_walk(body, scan_body, &scan);
+	}
+	if (body->result->storage == STORAGE_NEVER && !scan.returns) {
+		// Never returns, not worth inlining
+		return false;
+	}
+	// At higher levels, every eligible function is inlined
+	return scan.eligible && (level > 1 || scan.nodes <= INLINE_BUDGET);
+}
+
+static const struct declaration *
+lookup_candidate(const struct inline_candidate *cands,
+	const struct expression *call)
+{
+	const struct expression *lvalue = call->call.lvalue;
+	if (lvalue->type != EXPR_ACCESS
+			|| lvalue->access.type != ACCESS_IDENTIFIER
+			|| lvalue->access.object->otype != O_DECL) {
+		return NULL;
+	}
+	const struct scope_object *obj = lvalue->access.object;
+	char *sym = ident_to_sym(&obj->ident);
+	const struct declaration *decl = NULL;
+	for (; cands; cands = cands->next) {
+		if (cands->decl->func.type == obj->type
+				&& strcmp(cands->decl->symbol, sym) == 0) {
+			decl = cands->decl;
+			break;
+		}
+	}
+	free(sym);
+	return decl;
+}
+
+// Each copy of a body gets its own parameter objects, so that copies nested in
+// the arguments of another call to the same function don't clobber them.
+struct inline_params {
+	struct scope *scope;
+	const struct scope_object **from;
+	struct scope_object **to;
+	size_t n;
+};
+
+static bool
+rewrite_body(struct expression **slot, void *user)
+{
+	struct inline_params *params = user;
+	struct expression *expr = *slot;
+	switch (expr->type) {
+	case EXPR_ACCESS:
+		if (expr->access.type != ACCESS_IDENTIFIER) {
+			break;
+		}
+		for (size_t i = 0; i < params->n; ++i) {
+			if (expr->access.object == params->from[i]) {
+				expr->access.object = params->to[i];
+				break;
+			}
+		}
+		break;
+	case EXPR_RETURN:;
+		struct expression *value = expr->_return.value;
+		expr->type = EXPR_YIELD;
+		expr->control = (struct expression_control){
+			.scope = params->scope,
+			.value = value,
+		};
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+static struct expression *
+inline_call(const struct declaration *decl, const struct expression *call)
+{
+	struct inline_params params = { .scope = decl->func.scope };
+	for (const struct scope_object *obj = params.scope->objects;
+			obj; obj = obj->lnext) {
+		++params.n;
+	}
+	params.from = xcalloc(params.n + 1, sizeof(params.from[0]));
+	params.to = xcalloc(params.n + 1, sizeof(params.to[0]));
+	size_t i = 0;
+	for (const struct scope_object *obj = params.scope->objects;
+			obj; obj = obj->lnext, ++i) {
+		params.from[i] = obj;
+		params.to[i] = xcalloc(1, sizeof(struct scope_object));
+		*params.to[i] = *obj;
+		params.to[i]->lnext = params.to[i]->mnext = NULL;
+	}
+
+	struct expression *body = expr_copy(decl->func.body);
+	if (rewrite_body(&body, &params)) {
+		expr_walk(body, rewrite_body, &params);
+	}
+
+	struct expression *out = xcalloc(1, sizeof(struct expression));
+	out->type = EXPR_COMPOUND;
+	out->result = call->result;
+	out->loc = call->loc;
+	out->compound.scope = params.scope;
+	out->compound.exprs.expr = body;
+
+	if (params.n != 0) {
+		struct expression *inner = out;
+		out = xcalloc(1, sizeof(struct expression));
+		out->type = EXPR_COMPOUND;
+		out->result = call->result;
+		out->loc = call->loc;
+		struct scope *stack = NULL;
+		out->compound.scope = scope_push(&stack, SCOPE_COMPOUND);
+
+		struct expression *bind = xcalloc(1, sizeof(struct expression));
+		bind->type = EXPR_BINDING;
+		bind->result = &builtin_type_void;
+		bind->loc = call->loc;
+
+		struct expression_binding *binding = &bind->binding;
+		const struct call_argument *arg = call->call.args;
+		for (i = 0; i < params.n; ++i, arg = arg->next) {
+			if (i != 0) {
+				binding = binding->next =
+					xcalloc(1, sizeof(struct expression_binding));
+			}
+			binding->object = params.to[i];
+			binding->initializer = arg->value;
+		}
+		assert(arg == NULL);
+
+		struct expressions *exprs = &out->compound.exprs;
+		exprs->expr = bind;
+		exprs = exprs->next = xcalloc(1, sizeof(struct expressions));
+		exprs->expr = inner;
+	}
+
+	free(params.from);
+	free(params.to);
+	return out;
+}
+
+static bool
+inline_visit(struct expression **slot, void *user)
+{
+	const struct inline_candidate *cands = user;
+	expr_walk(*slot, inline_visit, user);
+
+	if ((*slot)->type != EXPR_CALL) {
+		return false;
+	}
+	const struct declaration *decl = lookup_candidate(cands, *slot);
+	if (decl) {
+		*slot = inline_call(decl, *slot);
+	}
+	return false;
+}
+
+static struct inline_candidate *
+add_candidates(struct inline_candidate *cands,
+	struct declarations *decls, int level)
+{
+	for (; decls; decls = decls->next) {
+		if (inlinable(&decls->decl, level)) {
+			struct inline_candidate *cand =
+				xcalloc(1, sizeof(struct inline_candidate));
+			cand->decl = &decls->decl;
+			cand->next = cands;
+			cands = cand;
+		}
+	}
+	return cands;
+}
+
+void
+opt_inline(struct unit *unit, int level)
+{
+	struct inline_candidate *cands =
+		add_candidates(NULL, unit->declarations, level);
+	// Imported bodies are only inlined; calls which aren't still refer to
+	// the external symbol
+	cands = add_candidates(cands, unit->imported, level);
+	if (!cands) {
+		return;
+	}
+
+	for (struct declarations *decls = unit->declarations;
+			decls; decls = decls->next) {
+		struct declaration *decl = &decls->decl;
+		if (decl->decl_type != DECL_FUNC || !decl->func.body) {
+			continue;
+		}
+		inline_visit(&decl->func.body, cands);
+	}
+
+	while (cands) {
+		struct inline_candidate *next = cands->next;
+		free(cands);
+		cands = next;
+	}
+}
@@ -10,6 +10,8 @@
 #include "emit.h"
 #include "gen.h"
 #include "lex.h"
+#include "mod.h"
+#include "opt.h"
 #include "parse.h"
 #include "qbe.h"
 #include "type_store.h"
@@ -20,7 +22,7 @@ static void
 usage(const char *argv_0)
 {
 	xfprintf(stderr,
-		"Usage: %s [-a arch] [-D ident[:type]=value] [-M path] [-m symbol] [-N namespace] [-o output] [-T] [-t typedefs] [-v] input.ha...\n\n",
+		"Usage: %s [-a arch] [-D ident[:type]=value] [-M path] [-m symbol] [-N namespace] [-O level] [-o output] [-T] [-t typedefs] [-v] input.ha... [module:: input.ha...]...\n\n",
 		argv_0);
 	xfprintf(stderr,
 		"-a: set target architecture\n"
@@ -29,10 +31,43 @@ usage(const char *argv_0)
 		"-M: set module path prefix, to be stripped from error messages\n"
 		"-m: set symbol of hosted main function\n"
 		"-N: override namespace for module\n"
+		"-O: set optimization level (0: none, 1: default, 2: inline regardless of size)\n"
 		"-o: set output file name\n"
 		"-T: emit tests\n"
 		"-t: emit typedefs to file\n"
-		"-v: print version and exit\n");
+		"-v: print version and exit\n"
+		"module:: names the module built from the inputs which follow it,\n"
+		"rather than from its typedefs, into the same output\n");
+}
+
+static void
+parse_namespace(const char *source, const char *in, struct identifier *ns)
+{
+	if (strlen(in) == 0) {
+		ns->name = "";
+		ns->ns = NULL;
+		return;
+	}
+	FILE *f = fmemopen((char *)in, strlen(in), "r");
+	if (f == NULL) {
+		perror("fmemopen");
+		exit(EXIT_ABNORMAL);
+	}
+	const char **old = sources;
+	sources = &source;
+	struct lexer lexer;
+	lex_init(&lexer, f, 0);
+	parse_identifier(&lexer, ns, false);
+	lex_finish(&lexer);
+	sources = old;
+}
+
+// Arguments of the form "module::" start the inputs of another module
+static bool
+is_module(const char *arg)
+{
+	size_t n = strlen(arg);
+	return n > 2 && strcmp(&arg[n - 2], "::") == 0;
 }
 
 static struct ast_global_decl *
@@ -77,12 +112,13 @@ main(int argc, char *argv[])
 	const char *modpath = NULL;
 	const char *mainsym = "main";
 	bool is_test = false;
+	int level = 1;
 	struct unit unit = {0};
 	struct lexer lexer;
 	struct ast_global_decl *defines = NULL, **next_def = &defines;
 
 	int c;
-	while ((c = getopt(argc, argv, "a:D:hM:m:N:o:Tt:v")) != -1) {
+	while ((c = getopt(argc, argv, "a:D:hM:m:N:O:o:Tt:v")) != -1) {
 		switch (c) {
 		case 'a':
 			target = optarg;
@@ -102,20 +138,14 @@ main(int argc, char *argv[])
 			break;
 		case 'N':
 			unit.ns = xcalloc(1, sizeof(struct identifier));
-			if (strlen(optarg) == 0) {
-				unit.ns->name = "";
-				unit.ns->ns = NULL;
-			} else {
-				FILE *in = fmemopen(optarg, strlen(optarg), "r");
-				if (in == NULL) {
-					perror("fmemopen");
-					exit(EXIT_ABNORMAL);
-				}
-				const char *ns = "-N";
-				sources = &ns;
-				lex_init(&lexer, in, 0);
-				parse_identifier(&lexer, unit.ns, false);
-				lex_finish(&lexer);
+			parse_namespace("-N", optarg, unit.ns);
+			break;
+		case 'O':;
+			char *end;
+			level = strtol(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' || level < 0) {
+				usage(argv[0]);
+				return EXIT_USER;
 			}
 			break;
 		case 'o':
@@ -138,19 +168,24 @@ main(int argc, char *argv[])
 
 	builtin_types_init(target);
 
-	nsources = argc - optind;
-	if (nsources == 0) {
+	nsources = 0;
+	for (int i = optind; i < argc; ++i) {
+		if (!is_module(argv[i])) {
+			++nsources;
+		}
+	}
+	if (nsources == 0 || is_module(argv[optind])) {
 		usage(argv[0]);
 		return EXIT_USER;
 	}
 
-	struct ast_unit aunit = {0};
-	struct ast_subunit *subunit = &aunit.subunits;
-	struct ast_subunit **next = &aunit.subunits.next;
-
 	sources = xcalloc(nsources + 2, sizeof(char **));
-	memcpy((char **)sources + 1, argv + optind, sizeof(char **) * nsources);
 	sources[0] = "<unknown>";
+	for (int i = optind, n = 1; i < argc; ++i) {
+		if (!is_module(argv[i])) {
+			sources[n++] = argv[i];
+		}
+	}
 
 	if (modpath) {
 		size_t modlen = strlen(modpath);
@@ -161,12 +196,34 @@ main(int argc, char *argv[])
 		}
 	}
 
-	for (size_t i = 0; i < nsources; ++i) {
+	struct modcache *modcache[MODCACHE_BUCKETS] = {0};
+	struct unit **modules = xcalloc(argc, sizeof(struct unit *));
+	size_t nmodules = 0;
+
+	struct ast_unit aunit = {0}, *maunit = &aunit;
+	struct ast_subunit *subunit = NULL;
+	int file = 1;
+	for (int i = optind; i < argc; ++i) {
 		FILE *in;
-		const char *path = argv[optind + i];
+		const char *path = argv[i];
+		if (is_module(path)) {
+			char *name = xstrdup(path);
+			name[strlen(name) - 2] = '\0';
+			struct unit *module = xcalloc(1, sizeof(struct unit));
+			module->ns = xcalloc(1, sizeof(struct identifier));
+			parse_namespace(path, name, module->ns);
+			free(name);
+
+			maunit = xcalloc(1, sizeof(struct ast_unit));
+			module_add(modcache, module->ns, maunit, module);
+			modules[nmodules++] = module;
+			subunit = NULL;
+			continue;
+		}
+
 		if (strcmp(path, "-") == 0) {
 			in = stdin;
-			sources[i + 1] = "<stdin>";
+			sources[file] = "<stdin>";
 		} else {
 			in = fopen(path, "r");
 			struct stat buf;
@@ -184,18 +241,34 @@ main(int argc, char *argv[])
 			return EXIT_ABNORMAL;
 		}
 
-		lex_init(&lexer, in,  i + 1);
-		parse(&lexer, subunit);
-		if (i + 1 < nsources) {
-			*next = xcalloc(1, sizeof(struct ast_subunit));
-			subunit = *next;
-			next = &subunit->next;
+		if (subunit == NULL) {
+			subunit = &maunit->subunits;
+		} else {
+			subunit->next = xcalloc(1, sizeof(struct ast_subunit));
+			subunit = subunit->next;
 		}
+		lex_init(&lexer, in, file++);
+		parse(&lexer, subunit);
 		lex_finish(&lexer);
 	}
 
 	static type_store ts = {0};
-	check(&ts, is_test, mainsym, defines, &aunit, &unit);
+	check(&ts, modcache, is_test, mainsym, defines, &aunit, &unit);
+	module_check_all(&ts, modcache, mainsym, defines);
+
+	// Functions exported with their bodies may be inlined into the unit
+	struct declarations **imported = &unit.imported;
+	for (size_t i = 0; i < MODCACHE_BUCKETS; ++i) {
+		for (struct modcache *mod = modcache[i]; mod; mod = mod->next) {
+			if (!mod->ctx) {
+				continue;
+			}
+			*imported = mod->ctx->decls;
+			while (*imported) {
+				imported = &(*imported)->next;
+			}
+		}
+	}
 
 	if (typedefs) {
 		FILE *out = fopen(typedefs, "w");
@@ -204,12 +277,28 @@ main(int argc, char *argv[])
 					typedefs, strerror(errno));
 			return EXIT_ABNORMAL;
 		}
-		emit_typedefs(&unit, out);
+		emit_typedefs(&unit, level != 0, out);
 		fclose(out);
 	}
 
+	// Modules built from source are optimized and generated as one program
+	// with the unit
+	struct declarations **tail = &unit.declarations;
+	for (size_t i = 0; i < nmodules; ++i) {
+		while (*tail) {
+			tail = &(*tail)->next;
+		}
+		*tail = modules[i]->declarations;
+	}
+
+	optimize(&unit, mainsym, level);
+
 	struct qbe_program prog = {0};
 	gen(&unit, &ts, &prog);
+	size_t removed = 0;
+	if (level != 0) {
+		removed = opt_peephole(&prog);
+	}
 
 	FILE *out;
 	if (!output) {
@@ -222,6 +311,9 @@ main(int argc, char *argv[])
 			return EXIT_ABNORMAL;
 		}
 	}
+	if (level != 0) {
+		xfprintf(out, "# peephole: %zu instructions removed\n\n", removed);
+	}
 	emit(&prog, out);
 	fclose(out);
 	return EXIT_SUCCESS;
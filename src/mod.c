@@ -17,7 +17,86 @@
 // don't want a VLA
 #define strlen_HARE_TD_ (sizeof("HARE_TD_") - 1)
 
-struct scope *
+void
+module_add(struct modcache **cache, const struct identifier *ident,
+	const struct ast_unit *aunit, struct unit *unit)
+{
+	uint32_t hash = identifier_hash(FNV1A_INIT, ident);
+	struct modcache **bucket = &cache[hash % MODCACHE_BUCKETS];
+	struct modcache *item = xcalloc(1, sizeof(struct modcache));
+	identifier_dup(&item->ident, ident);
+	item->aunit = aunit;
+	item->unit = unit;
+	item->next = *bucket;
+	*bucket = item;
+}
+
+// Returns a scope holding the exported objects of a module's unit scope, named
+// as they are in its typedefs.
+static struct scope *
+module_exports(const struct identifier *ns, const struct scope *unit)
+{
+	struct scope *scope = NULL;
+	scope_push(&scope, SCOPE_UNIT);
+	for (const struct scope_object *obj = unit->objects;
+			obj; obj = obj->lnext) {
+		const struct incomplete_declaration *idecl =
+			(const struct incomplete_declaration *)obj;
+		struct identifier name = obj->name, enum_name;
+		if (idecl->type == IDECL_ENUM_FLD) {
+			// Enum values are named within their type, and are
+			// exported along with it
+			idecl = (const struct incomplete_declaration *)
+				scope_lookup((struct scope *)unit, obj->name.ns);
+			enum_name = *obj->name.ns;
+			enum_name.ns = (struct identifier *)ns;
+			name.ns = &enum_name;
+		} else {
+			name.ns = (struct identifier *)ns;
+		}
+		if (idecl == NULL || !idecl->decl.exported) {
+			continue;
+		}
+		// obj->type and obj->value are a union, so it doesn't matter
+		// which is passed into scope_insert
+		struct scope_object *new = scope_insert(scope, obj->otype,
+			&obj->ident, &name, obj->type, NULL);
+		new->threadlocal = obj->threadlocal;
+	}
+	return scope;
+}
+
+static struct scope *
+module_check(type_store *ts, struct modcache **cache, const char *mainsym,
+	const struct ast_global_decl *defines, struct modcache *mod)
+{
+	if (mod->in_progress) {
+		xfprintf(stderr, "Error: module '%s' imports itself\n",
+			identifier_unparse(&mod->ident));
+		exit(EXIT_CHECK);
+	}
+	mod->in_progress = true;
+	struct scope *scope = check_internal(ts, cache, false, mainsym,
+		defines, mod->aunit, mod->unit, NULL);
+	mod->scope = module_exports(&mod->ident, scope);
+	mod->in_progress = false;
+	return mod->scope;
+}
+
+void
+module_check_all(type_store *ts, struct modcache **cache,
+	const char *mainsym, const struct ast_global_decl *defines)
+{
+	for (size_t i = 0; i < MODCACHE_BUCKETS; ++i) {
+		for (struct modcache *mod = cache[i]; mod; mod = mod->next) {
+			if (mod->aunit && !mod->scope) {
+				module_check(ts, cache, mainsym, defines, mod);
+			}
+		}
+	}
+}
+
+struct modcache *
 module_resolve(struct context *ctx,
 	const struct ast_global_decl *defines,
 	const struct identifier *ident)
@@ -25,9 +104,14 @@ module_resolve(struct context *ctx,
 	uint32_t hash = identifier_hash(FNV1A_INIT, ident);
 	struct modcache **bucket = &ctx->modcache[hash % MODCACHE_BUCKETS];
 	for (; *bucket; bucket = &(*bucket)->next) {
-		if (identifier_eq(&(*bucket)->ident, ident)) {
-			return (*bucket)->scope;
+		if (!identifier_eq(&(*bucket)->ident, ident)) {
+			continue;
+		}
+		if ((*bucket)->aunit && !(*bucket)->scope) {
+			module_check(ctx->store, ctx->modcache,
+				ctx->mainsym, defines, *bucket);
 		}
+		return *bucket;
 	}
 
 	struct lexer lexer = {0};
@@ -60,15 +144,18 @@ module_resolve(struct context *ctx,
 
 	// TODO: Free unused bits
 	struct unit u = {0};
+	struct context *lazy = NULL;
 	struct scope *scope = check_internal(ctx->store, ctx->modcache,
-		ctx->is_test, ctx->mainsym, defines, &aunit, &u, true);
+		ctx->is_test, ctx->mainsym, defines, &aunit, &u, &lazy);
 
 	sources[0] = old;
 	bucket = &ctx->modcache[hash % MODCACHE_BUCKETS];
 	struct modcache *item = xcalloc(1, sizeof(struct modcache));
 	identifier_dup(&item->ident, ident);
 	item->scope = scope;
+	item->ctx = lazy;
+	item->path = path;
 	item->next = *bucket;
 	*bucket = item;
-	return scope;
+	return item;
 }
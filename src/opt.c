@@ -0,0 +1,338 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "check.h"
+#include "expr.h"
+#include "opt.h"
+#include "scope.h"
+#include "types.h"
+#include "util.h"
+
+static void
+walk_slot(struct expression **slot, expr_visitor visit, void *user)
+{
+	if (*slot == NULL) {
+		return;
+	}
+	if (visit(slot, user)) {
+		expr_walk(*slot, visit, user);
+	}
+}
+
+void
+expr_walk(struct expression *expr, expr_visitor visit, void *user)
+{
+	switch (expr->type) {
+	case EXPR_ACCESS:
+		switch (expr->access.type) {
+		case ACCESS_IDENTIFIER:
+			break;
+		case ACCESS_INDEX:
+			walk_slot(&expr->access.array, visit, user);
+			walk_slot(&expr->access.index, visit, user);
+			break;
+		case ACCESS_FIELD:
+			walk_slot(&expr->access._struct, visit, user);
+			break;
+		case ACCESS_TUPLE:
+			walk_slot(&expr->access.tuple, visit, user);
+			break;
+		}
+		break;
+	case EXPR_ALLOC:
+		walk_slot(&expr->alloc.init, visit, user);
+		walk_slot(&expr->alloc.cap, visit, user);
+		break;
+	case EXPR_APPEND:
+	case EXPR_INSERT:
+		walk_slot(&expr->append.object, visit, user);
+		walk_slot(&expr->append.value, visit, user);
+		walk_slot(&expr->append.length, visit, user);
+		break;
+	case EXPR_ASSERT:
+		walk_slot(&expr->assert.cond, visit, user);
+		walk_slot(&expr->assert.message, visit, user);
+		break;
+	case EXPR_ASSIGN:
+		walk_slot(&expr->assign.object, visit, user);
+		walk_slot(&expr->assign.value, visit, user);
+		break;
+	case EXPR_BINARITHM:
+		walk_slot(&expr->binarithm.lvalue, visit, user);
+		walk_slot(&expr->binarithm.rvalue, visit, user);
+		break;
+	case EXPR_BINDING:
+		for (struct expression_binding *binding = &expr->binding;
+				binding; binding = binding->next) {
+			walk_slot(&binding->initializer, visit, user);
+		}
+		break;
+	case EXPR_BREAK:
+	case EXPR_CONTINUE:
+	case EXPR_DEFINE:
+	case EXPR_VASTART:
+		break;
+	case EXPR_CALL:
+		walk_slot(&expr->call.lvalue, visit, user);
+		for (struct call_argument *arg = expr->call.args;
+				arg; arg = arg->next) {
+			walk_slot(&arg->value, visit, user);
+		}
+		break;
+	case EXPR_CAST:
+		walk_slot(&expr->cast.value, visit, user);
+		break;
+	case EXPR_COMPOUND:
+		for (struct expressions *exprs = &expr->compound.exprs;
+				exprs; exprs = exprs->next) {
+			walk_slot(&exprs->expr, visit, user);
+		}
+		break;
+	case EXPR_DEFER:
+		walk_slot(&expr->defer.deferred, visit, user);
+		break;
+	case EXPR_DELETE:
+		walk_slot(&expr->delete.expr, visit, user);
+		break;
+	case EXPR_FOR:
+		walk_slot(&expr->_for.bindings, visit, user);
+		walk_slot(&expr->_for.cond, visit, user);
+		walk_slot(&expr->_for.body, visit, user);
+		walk_slot(&expr->_for.afterthought, visit, user);
+		break;
+	case EXPR_FREE:
+		walk_slot(&expr->free.expr, visit, user);
+		break;
+	case EXPR_IF:
+		walk_slot(&expr->_if.cond, visit, user);
+		walk_slot(&expr->_if.true_branch, visit, user);
+		walk_slot(&expr->_if.false_branch, visit, user);
+		break;
+	case EXPR_LEN:
+		walk_slot(&expr->len.value, visit, user);
+		break;
+	case EXPR_LITERAL:
+		switch (type_dealias(NULL, expr->result)->storage) {
+		case STORAGE_ARRAY:
+			for (struct array_literal *item = expr->literal.array;
+					item; item = item->next) {
+				walk_slot(&item->value, visit, user);
+			}
+			break;
+		case STORAGE_STRUCT:
+		case STORAGE_UNION:
+			for (struct struct_literal *field = expr->literal._struct;
+					field; field = field->next) {
+				walk_slot(&field->value, visit, user);
+			}
+			break;
+		case STORAGE_TUPLE:
+			for (struct tuple_literal *item = expr->literal.tuple;
+					item; item = item->next) {
+				walk_slot(&item->value, visit, user);
+			}
+			break;
+		case STORAGE_TAGGED:
+			walk_slot(&expr->literal.tagged.value, visit, user);
+			break;
+		default:
+			break;
+		}
+		break;
+	case EXPR_MATCH:
+		walk_slot(&expr->match.value, visit, user);
+		for (struct match_case *_case = expr->match.cases;
+				_case; _case = _case->next) {
+			walk_slot(&_case->value, visit, user);
+		}
+		break;
+	case EXPR_PROPAGATE:
+		assert(0); // Lowered in check
+	case EXPR_RETURN:
+		walk_slot(&expr->_return.value, visit, user);
+		break;
+	case EXPR_SLICE:
+		walk_slot(&expr->slice.object, visit, user);
+		walk_slot(&expr->slice.start, visit, user);
+		walk_slot(&expr->slice.end, visit, user);
+		break;
+	case EXPR_STRUCT:
+		for (struct expr_struct_field *field = expr->_struct.fields;
+				field; field = field->next) {
+			walk_slot(&field->value, visit, user);
+		}
+		break;
+	case EXPR_SWITCH:
+		walk_slot(&expr->_switch.value, visit, user);
+		for (struct switch_case *_case = expr->_switch.cases;
+				_case; _case = _case->next) {
+			for (struct case_option *opt = _case->options;
+					opt; opt = opt->next) {
+				walk_slot(&opt->value, visit, user);
+			}
+			walk_slot(&_case->value, visit, user);
+		}
+		break;
+	case EXPR_TUPLE:
+		for (struct expression_tuple *item = &expr->tuple;
+				item; item = item->next) {
+			walk_slot(&item->value, visit, user);
+		}
+		break;
+	case EXPR_UNARITHM:
+		walk_slot(&expr->unarithm.operand, visit, user);
+		break;
+	case EXPR_VAARG:
+	case EXPR_VAEND:
+		walk_slot(&expr->vaarg.ap, visit, user);
+		break;
+	case EXPR_YIELD:
+		walk_slot(&expr->control.value, visit, user);
+		break;
+	}
+}
+
+static bool
+copy_slot(struct expression **slot, void *user)
+{
+	*slot = expr_copy(*slot);
+	return false;
+}
+
+struct expression *
+expr_copy(const struct expression *expr)
+{
+	struct expression *out = xcalloc(1, sizeof(struct expression));
+	*out = *expr;
+
+	// Duplicate the lists which hold subexpressions, so that expr_walk
+	// replaces them in the copy only
+	switch (out->type) {
+	case EXPR_BINDING:
+		for (struct expression_binding **binding = &out->binding.next;
+				*binding; binding = &(*binding)->next) {
+			struct expression_binding *new = xcalloc(1, sizeof(*new));
+			*new = **binding;
+			*binding = new;
+		}
+		break;
+	case EXPR_CALL:
+		for (struct call_argument **arg = &out->call.args;
+				*arg; arg = &(*arg)->next) {
+			struct call_argument *new = xcalloc(1, sizeof(*new));
+			*new = **arg;
+			*arg = new;
+		}
+		break;
+	case EXPR_COMPOUND:
+		for (struct expressions **exprs = &out->compound.exprs.next;
+				*exprs; exprs = &(*exprs)->next) {
+			struct expressions *new = xcalloc(1, sizeof(*new));
+			*new = **exprs;
+			*exprs = new;
+		}
+		break;
+	case EXPR_LITERAL:
+		switch (type_dealias(NULL, out->result)->storage) {
+		case STORAGE_ARRAY:
+			for (struct array_literal **item = &out->literal.array;
+					*item; item = &(*item)->next) {
+				struct array_literal *new = xcalloc(1, sizeof(*new));
+				*new = **item;
+				*item = new;
+			}
+			break;
+		case STORAGE_STRUCT:
+		case STORAGE_UNION:
+			for (struct struct_literal **field = &out->literal._struct;
+					*field; field = &(*field)->next) {
+				struct struct_literal *new = xcalloc(1, sizeof(*new));
+				*new = **field;
+				*field = new;
+			}
+			break;
+		case STORAGE_TUPLE:
+			for (struct tuple_literal **item = &out->literal.tuple;
+					*item; item = &(*item)->next) {
+				struct tuple_literal *new = xcalloc(1, sizeof(*new));
+				*new = **item;
+				*item = new;
+			}
+			break;
+		default:
+			break;
+		}
+		break;
+	case EXPR_MATCH:
+		for (struct match_case **_case = &out->match.cases;
+				*_case; _case = &(*_case)->next) {
+			struct match_case *new = xcalloc(1, sizeof(*new));
+			*new = **_case;
+			*_case = new;
+		}
+		break;
+	case EXPR_STRUCT:
+		for (struct expr_struct_field **field = &out->_struct.fields;
+				*field; field = &(*field)->next) {
+			struct expr_struct_field *new = xcalloc(1, sizeof(*new));
+			*new = **field;
+			*field = new;
+		}
+		break;
+	case EXPR_SWITCH:
+		for (struct switch_case **_case = &out->_switch.cases;
+				*_case; _case = &(*_case)->next) {
+			struct switch_case *new = xcalloc(1, sizeof(*new));
+			*new = **_case;
+			*_case = new;
+			for (struct case_option **opt = &new->options;
+					*opt; opt = &(*opt)->next) {
+				struct case_option *nopt = xcalloc(1, sizeof(*nopt));
+				*nopt = **opt;
+				*opt = nopt;
+			}
+		}
+		break;
+	case EXPR_TUPLE:
+		for (struct expression_tuple **item = &out->tuple.next;
+				*item; item = &(*item)->next) {
+			struct expression_tuple *new = xcalloc(1, sizeof(*new));
+			*new = **item;
+			*item = new;
+		}
+		break;
+	default:
+		break;
+	}
+
+	expr_walk(out, copy_slot, NULL);
+	return out;
+}
+
+bool
+expr_is_ident(const struct expression *expr, const struct scope_object *obj)
+{
+	return expr->type == EXPR_ACCESS
+		&& expr->access.type == ACCESS_IDENTIFIER
+		&& expr->access.object == obj;
+}
+
+void
+optimize(struct unit *unit, const char *mainsym, int level)
+{
+	if (level == 0) {
+		return;
+	}
+	opt_inline(unit, level);
+	opt_prune(unit, mainsym);
+	for (struct declarations *decls = unit->declarations;
+			decls; decls = decls->next) {
+		struct declaration *decl = &decls->decl;
+		if (decl->decl_type != DECL_FUNC || !decl->func.body) {
+			continue;
+		}
+		opt_fold(decl);
+		opt_escape(decl);
+		opt_bounds(decl);
+	}
+}
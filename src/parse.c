@@ -1,11 +1,16 @@
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdnoreturn.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "ast.h"
 #include "identifier.h"
 #include "lex.h"
@@ -1206,6 +1211,62 @@ parse_measurement_expression(struct lexer *lexer)
 	return exp;
 }
 
+static struct ast_expression *
+parse_embed_expression(struct lexer *lexer)
+{
+	struct ast_expression *exp = mkexpr(lexer->loc);
+	exp->type = EXPR_LITERAL;
+	exp->literal.storage = STORAGE_ARRAY;
+
+	struct token tok = {0};
+	want(lexer, T_ATTR_EMBED, NULL);
+	want(lexer, T_LPAREN, NULL);
+	want(lexer, T_NUMBER, &tok);
+	synassert_msg(tok.storage == STORAGE_STRING,
+		"expected string literal", &tok);
+	synassert_msg(tok.string.len > 0
+		&& memchr(tok.string.value, '\0', tok.string.len) == NULL,
+		"invalid path", &tok);
+
+	// Relative paths are relative to the directory of this source file
+	const char *src = sources[tok.loc.file];
+	const char *slash = strrchr(src, '/');
+	size_t dirlen = 0;
+	if (tok.string.value[0] != '/' && slash != NULL) {
+		dirlen = slash - src + 1;
+	}
+	char *path = xcalloc(1, dirlen + tok.string.len + 1);
+	memcpy(path, src, dirlen);
+	memcpy(path + dirlen, tok.string.value, tok.string.len);
+	want(lexer, T_RPAREN, NULL);
+
+	// The file is mapped rather than read, and stays mapped for the rest of
+	// the compilation, so its contents can be emitted in place
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		error(tok.loc, "unable to open %s: %s", path, strerror(errno));
+	}
+	if (!S_ISREG(st.st_mode)) {
+		error(tok.loc, "unable to embed %s: not a regular file", path);
+	}
+	struct packed_literal *packed = xcalloc(1, sizeof(*packed));
+	packed->len = st.st_size;
+	packed->data = "";
+	if (packed->len != 0) {
+		packed->data = mmap(NULL, packed->len,
+			PROT_READ, MAP_PRIVATE, fd, 0);
+		if (packed->data == MAP_FAILED) {
+			error(tok.loc, "unable to map %s: %s",
+				path, strerror(errno));
+		}
+	}
+	close(fd);
+	free(path);
+	exp->literal.packed = packed;
+	return exp;
+}
+
 static struct ast_expression *
 parse_call_expression(struct lexer *lexer, struct ast_expression *lvalue)
 {
@@ -1589,6 +1650,9 @@ parse_builtin_expression(struct lexer *lexer)
 	case T_OFFSET:
 		unlex(lexer, &tok);
 		return parse_measurement_expression(lexer);
+	case T_ATTR_EMBED:
+		unlex(lexer, &tok);
+		return parse_embed_expression(lexer);
 	case T_VAARG:
 	case T_VAEND:
 	case T_VASTART:
@@ -0,0 +1,772 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opt.h"
+#include "qbe.h"
+#include "util.h"
+
+// Peephole optimization of generated IR
+//
+// Each function's body is rewritten one basic block at a time. Temporaries
+// aren't in SSA form (gen assigns to them from several blocks, and updates
+// them in place), so everything known about a temporary holds only until the
+// end of the block or until it is assigned again, whichever comes first.
+//
+// Within a block, copies of temporaries and integer constants are propagated
+// into their uses, loads from an address just stored to are replaced with the
+// stored value, and arithmetic on constants is folded or reduced in strength:
+// multiplication, unsigned division and remainder by powers of two become
+// shifts and masks, and operations with an identity operand become copies.
+// Definitions which are no longer used, anywhere in the function or before
+// the temporary is next assigned in the same block, are then removed.
+
+// Facts about stores remembered within a block
+#define MEM_FACTS 8
+
+struct ptemp {
+	const char *name;
+	size_t uses;
+	uint32_t version; // Bumped on each definition
+	bool alloc; // Result of an alloc in the prelude, and never reassigned
+
+	// The current definition, valid only within block
+	size_t block;
+	enum {
+		DEF_OTHER,
+		DEF_COPY, // copy of value
+		DEF_BOOL, // the result of a comparison
+		DEF_EQZ, // src == 0
+		DEF_NEZ, // src != 0
+	} def;
+	struct qbe_value value;
+	struct ptemp *src;
+	uint32_t src_version;
+
+	// Set while scanning a block backwards if the temporary is assigned
+	// later in the block, without being used first
+	size_t killed;
+};
+
+struct mem_fact {
+	enum qbe_instr store;
+	struct ptemp *addr;
+	uint32_t addr_version;
+	struct qbe_value value;
+	struct ptemp *src;
+	uint32_t src_version;
+};
+
+struct peephole {
+	struct ptemp *temps;
+	size_t ntemps, sz;
+	size_t block;
+	struct mem_fact facts[MEM_FACTS];
+	size_t nfacts;
+};
+
+static struct ptemp *
+lookup(struct peephole *ctx, const char *name)
+{
+	if ((ctx->ntemps + 1) * 2 > ctx->sz) {
+		struct ptemp *old = ctx->temps;
+		size_t oldsz = ctx->sz;
+		ctx->sz = ctx->sz ? ctx->sz * 2 : 256;
+		ctx->temps = xcalloc(ctx->sz, sizeof(struct ptemp));
+		for (size_t i = 0; i < oldsz; ++i) {
+			if (!old[i].name) {
+				continue;
+			}
+			size_t j = fnv1a_s(FNV1A_INIT, old[i].name) & (ctx->sz - 1);
+			while (ctx->temps[j].name) {
+				j = (j + 1) & (ctx->sz - 1);
+			}
+			ctx->temps[j] = old[i];
+		}
+		free(old);
+	}
+	size_t i = fnv1a_s(FNV1A_INIT, name) & (ctx->sz - 1);
+	while (ctx->temps[i].name) {
+		if (strcmp(ctx->temps[i].name, name) == 0) {
+			return &ctx->temps[i];
+		}
+		i = (i + 1) & (ctx->sz - 1);
+	}
+	ctx->temps[i].name = name;
+	++ctx->ntemps;
+	return &ctx->temps[i];
+}
+
+// Pointers into the table are invalidated when it grows, so every temporary
+// is entered before any are looked at
+static void
+enter_temps(struct peephole *ctx, const struct qbe_statements *stmts)
+{
+	for (size_t i = 0; i < stmts->ln; ++i) {
+		const struct qbe_statement *stmt = &stmts->stmts[i];
+		if (stmt->type != Q_INSTR) {
+			continue;
+		}
+		if (stmt->out && stmt->out->kind == QV_TEMPORARY) {
+			lookup(ctx, stmt->out->name);
+		}
+		for (struct qbe_arguments *arg = stmt->args; arg; arg = arg->next) {
+			if (arg->value.kind == QV_TEMPORARY) {
+				lookup(ctx, arg->value.name);
+			}
+		}
+	}
+}
+
+static enum qbe_stype
+qclass(const struct qbe_type *type)
+{
+	switch (type->stype) {
+	case Q_BYTE:
+	case Q_HALF:
+	case Q_WORD:
+		return Q_WORD;
+	case Q_LONG:
+	case Q__AGGREGATE:
+	case Q__UNION:
+		return Q_LONG;
+	case Q_SINGLE:
+	case Q_DOUBLE:
+	case Q__VOID:
+		return type->stype;
+	}
+	abort(); // Unreachable
+}
+
+static bool
+is_int(const struct qbe_type *type)
+{
+	enum qbe_stype class = qclass(type);
+	return class == Q_WORD || class == Q_LONG;
+}
+
+static uint64_t
+const_val(const struct qbe_value *val)
+{
+	assert(val->kind == QV_CONST);
+	if (qclass(val->type) == Q_LONG) {
+		return val->lval;
+	}
+	return val->wval;
+}
+
+static bool
+is_const(const struct qbe_value *val, uint64_t n)
+{
+	return val->kind == QV_CONST && is_int(val->type)
+		&& const_val(val) == n;
+}
+
+// Returns the constant as an integer of the given class
+static struct qbe_value
+const_of(const struct qbe_type *type, uint64_t n)
+{
+	return qclass(type) == Q_LONG ? constl(n) : constw((uint32_t)n);
+}
+
+static int
+log2_of(uint64_t n)
+{
+	if (n == 0 || (n & (n - 1)) != 0) {
+		return -1;
+	}
+	int k = 0;
+	while (n >>= 1) {
+		++k;
+	}
+	return k;
+}
+
+static bool
+is_compare(enum qbe_instr instr)
+{
+	return instr >= Q_CEQD && instr <= Q_CUOS && instr != Q_COPY;
+}
+
+static bool
+is_pure(enum qbe_instr instr)
+{
+	if (is_compare(instr)) {
+		return true;
+	}
+	switch (instr) {
+	case Q_ADD:
+	case Q_AND:
+	case Q_CAST:
+	case Q_COPY:
+	case Q_DTOSI:
+	case Q_DTOUI:
+	case Q_EXTS:
+	case Q_EXTSB:
+	case Q_EXTSH:
+	case Q_EXTSW:
+	case Q_EXTUB:
+	case Q_EXTUH:
+	case Q_EXTUW:
+	case Q_MUL:
+	case Q_NEG:
+	case Q_OR:
+	case Q_SAR:
+	case Q_SHL:
+	case Q_SHR:
+	case Q_SLTOF:
+	case Q_STOSI:
+	case Q_STOUI:
+	case Q_SUB:
+	case Q_SWTOF:
+	case Q_TRUNCD:
+	case Q_ULTOF:
+	case Q_UWTOF:
+	case Q_XOR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool
+is_store(enum qbe_instr instr)
+{
+	return instr >= Q_STOREB && instr <= Q_STOREW;
+}
+
+static void
+set_args(struct qbe_statement *stmt, enum qbe_instr instr,
+	const struct qbe_value *a, const struct qbe_value *b)
+{
+	stmt->instr = instr;
+	stmt->args->value = *a;
+	if (b) {
+		assert(stmt->args->next);
+		stmt->args->next->value = *b;
+	} else {
+		stmt->args->next = NULL;
+	}
+}
+
+static void
+to_copy(struct qbe_statement *stmt, const struct qbe_value *val)
+{
+	set_args(stmt, Q_COPY, val, NULL);
+}
+
+// Replaces a use of a temporary with the value it was copied from
+static void
+substitute(struct peephole *ctx, const struct qbe_statement *stmt,
+	struct qbe_value *use)
+{
+	if (use->kind != QV_TEMPORARY) {
+		return;
+	}
+	struct ptemp *t = lookup(ctx, use->name);
+	if (t->block != ctx->block || t->def != DEF_COPY
+			|| (t->src && t->src->version != t->src_version)) {
+		return;
+	}
+	if (t->value.kind == QV_CONST) {
+		if (!is_int(use->type) || stmt->instr == Q_CAST) {
+			return;
+		}
+		*use = const_of(use->type, const_val(&t->value));
+		return;
+	}
+	// Call arguments are printed with their type, which is kept
+	use->kind = t->value.kind;
+	use->name = t->value.name;
+}
+
+static void
+simplify(struct qbe_statement *stmt)
+{
+	if (!stmt->out || !stmt->args || !stmt->args->next
+			|| !is_int(stmt->out->type)) {
+		return;
+	}
+	struct qbe_value *a = &stmt->args->value, *b = &stmt->args->next->value;
+	const struct qbe_type *type = stmt->out->type;
+	bool longs = qclass(type) == Q_LONG;
+	uint64_t mask = longs ? UINT64_MAX : UINT32_MAX;
+	int shift = longs ? 63 : 31, k;
+
+	if (a->kind == QV_CONST && b->kind == QV_CONST
+			&& is_int(a->type) && is_int(b->type)) {
+		uint64_t x = const_val(a), y = const_val(b), r;
+		switch (stmt->instr) {
+		case Q_ADD: r = x + y; break;
+		case Q_SUB: r = x - y; break;
+		case Q_MUL: r = x * y; break;
+		case Q_AND: r = x & y; break;
+		case Q_OR: r = x | y; break;
+		case Q_XOR: r = x ^ y; break;
+		case Q_SHL: r = x << (y & shift); break;
+		case Q_SHR: r = (x & mask) >> (y & shift); break;
+		default: return;
+		}
+		struct qbe_value val = const_of(type, r & mask);
+		to_copy(stmt, &val);
+		return;
+	}
+
+	switch (stmt->instr) {
+	case Q_ADD:
+	case Q_OR:
+	case Q_XOR:
+		if (is_const(a, 0)) {
+			to_copy(stmt, b);
+		} else if (is_const(b, 0)) {
+			to_copy(stmt, a);
+		}
+		break;
+	case Q_SUB:
+	case Q_SHL:
+	case Q_SHR:
+	case Q_SAR:
+		if (is_const(b, 0)) {
+			to_copy(stmt, a);
+		}
+		break;
+	case Q_AND:
+		if (is_const(a, 0) || is_const(b, 0)) {
+			struct qbe_value zero = const_of(type, 0);
+			to_copy(stmt, &zero);
+		}
+		break;
+	case Q_MUL:
+		if (a->kind == QV_CONST && is_int(a->type)) {
+			struct qbe_value tmp = *a;
+			*a = *b;
+			*b = tmp;
+		}
+		if (b->kind != QV_CONST || !is_int(b->type)) {
+			break;
+		}
+		k = log2_of(const_val(b) & mask);
+		if (const_val(b) == 0) {
+			struct qbe_value zero = const_of(type, 0);
+			to_copy(stmt, &zero);
+		} else if (k == 0) {
+			to_copy(stmt, a);
+		} else if (k > 0) {
+			struct qbe_value n = constw(k);
+			set_args(stmt, Q_SHL, a, &n);
+		}
+		break;
+	case Q_UDIV:
+	case Q_UREM:
+		if (b->kind != QV_CONST || !is_int(b->type)) {
+			break;
+		}
+		k = log2_of(const_val(b) & mask);
+		if (k < 0) {
+			break;
+		} else if (stmt->instr == Q_UREM && k == 0) {
+			struct qbe_value zero = const_of(type, 0);
+			to_copy(stmt, &zero);
+		} else if (stmt->instr == Q_UREM) {
+			struct qbe_value m = const_of(type,
+				(const_val(b) & mask) - 1);
+			set_args(stmt, Q_AND, a, &m);
+		} else if (k == 0) {
+			to_copy(stmt, a);
+		} else {
+			struct qbe_value n = constw(k);
+			set_args(stmt, Q_SHR, a, &n);
+		}
+		break;
+	case Q_DIV:
+		if (is_const(b, 1)) {
+			to_copy(stmt, a);
+		}
+		break;
+	case Q_REM:
+		if (is_const(b, 1)) {
+			struct qbe_value zero = const_of(type, 0);
+			to_copy(stmt, &zero);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// Returns true if the temporary is the result of a comparison in this block
+static bool
+is_bool(struct peephole *ctx, const struct qbe_value *val)
+{
+	if (val->kind != QV_TEMPORARY) {
+		return false;
+	}
+	struct ptemp *t = lookup(ctx, val->name);
+	return t->block == ctx->block && (t->def == DEF_BOOL
+		|| t->def == DEF_EQZ || t->def == DEF_NEZ);
+}
+
+static bool
+fact_valid(const struct mem_fact *fact)
+{
+	return fact->addr->version == fact->addr_version
+		&& (!fact->src || fact->src->version == fact->src_version);
+}
+
+static void
+forget(struct peephole *ctx, size_t i)
+{
+	ctx->facts[i] = ctx->facts[--ctx->nfacts];
+}
+
+static void
+remember_store(struct peephole *ctx, struct qbe_statement *stmt)
+{
+	const struct qbe_value *val = &stmt->args->value;
+	const struct qbe_value *addr = &stmt->args->next->value;
+	if (addr->kind != QV_TEMPORARY) {
+		// Stores to globals may be to anything we know about
+		ctx->nfacts = 0;
+		return;
+	}
+	struct ptemp *a = lookup(ctx, addr->name);
+	for (size_t i = 0; i < ctx->nfacts; /* n/a */) {
+		// Separate allocations don't overlap
+		struct mem_fact *fact = &ctx->facts[i];
+		if (!fact_valid(fact) || fact->addr == a
+				|| !a->alloc || !fact->addr->alloc) {
+			forget(ctx, i);
+		} else {
+			++i;
+		}
+	}
+	if (ctx->nfacts == MEM_FACTS
+			|| (val->kind == QV_GLOBAL && val->threadlocal)) {
+		return;
+	}
+	struct mem_fact *fact = &ctx->facts[ctx->nfacts++];
+	fact->store = stmt->instr;
+	fact->addr = a;
+	fact->addr_version = a->version;
+	fact->value = *val;
+	fact->src = NULL;
+	if (val->kind == QV_TEMPORARY) {
+		fact->src = lookup(ctx, val->name);
+		fact->src_version = fact->src->version;
+	}
+}
+
+// Replaces a load from an address just stored to with the value stored
+static void
+forward_store(struct peephole *ctx, struct qbe_statement *stmt)
+{
+	const struct qbe_value *addr = &stmt->args->value;
+	if (addr->kind != QV_TEMPORARY) {
+		return;
+	}
+	struct ptemp *a = lookup(ctx, addr->name);
+	struct mem_fact *fact = NULL;
+	for (size_t i = 0; i < ctx->nfacts; ++i) {
+		if (ctx->facts[i].addr == a && fact_valid(&ctx->facts[i])) {
+			fact = &ctx->facts[i];
+			break;
+		}
+	}
+	if (!fact) {
+		return;
+	}
+
+	enum qbe_stype out = qclass(stmt->out->type);
+	struct qbe_value val = fact->value;
+	enum qbe_instr ext;
+	switch (fact->store) {
+	case Q_STOREL:
+		if (stmt->instr != Q_LOADL || qclass(val.type) != Q_LONG) {
+			return;
+		}
+		ext = Q_COPY;
+		break;
+	case Q_STORED:
+		if (stmt->instr != Q_LOADD || qclass(val.type) != Q_DOUBLE) {
+			return;
+		}
+		ext = Q_COPY;
+		break;
+	case Q_STORES:
+		if (stmt->instr != Q_LOADS || qclass(val.type) != Q_SINGLE) {
+			return;
+		}
+		ext = Q_COPY;
+		break;
+	case Q_STOREW:
+		if (stmt->instr != Q_LOADUW && stmt->instr != Q_LOADSW) {
+			return;
+		}
+		if (out == Q_WORD && qclass(val.type) == Q_WORD) {
+			ext = Q_COPY;
+		} else {
+			ext = stmt->instr == Q_LOADUW ? Q_EXTUW : Q_EXTSW;
+		}
+		break;
+	case Q_STOREH:
+		if (stmt->instr != Q_LOADUH && stmt->instr != Q_LOADSH) {
+			return;
+		}
+		ext = stmt->instr == Q_LOADUH ? Q_EXTUH : Q_EXTSH;
+		break;
+	case Q_STOREB:
+		if (stmt->instr != Q_LOADUB && stmt->instr != Q_LOADSB) {
+			return;
+		}
+		ext = stmt->instr == Q_LOADUB ? Q_EXTUB : Q_EXTSB;
+		break;
+	default:
+		abort(); // Invariant
+	}
+	if (ext != Q_COPY && (val.kind != QV_TEMPORARY
+			|| qclass(val.type) != Q_WORD)) {
+		return;
+	}
+	stmt->instr = ext;
+	stmt->args->value = val;
+}
+
+// Branches on a comparison with zero test the compared value directly, and
+// branches on constants are replaced with jumps
+static void
+simplify_branch(struct peephole *ctx, struct qbe_statement *stmt)
+{
+	struct qbe_arguments *cond = stmt->args;
+	struct qbe_arguments *bt = cond->next, *bf = bt->next;
+	if (cond->value.kind == QV_CONST) {
+		stmt->instr = Q_JMP;
+		stmt->args = is_const(&cond->value, 0) ? bf : bt;
+		stmt->args->next = NULL;
+		return;
+	}
+	for (int i = 0; i < 4 && cond->value.kind == QV_TEMPORARY; ++i) {
+		struct ptemp *t = lookup(ctx, cond->value.name);
+		if (t->block != ctx->block || (t->def != DEF_EQZ
+				&& t->def != DEF_NEZ)
+				|| t->src->version != t->src_version) {
+			return;
+		}
+		cond->value = t->value;
+		if (t->def == DEF_EQZ) {
+			struct qbe_value tmp = bt->value;
+			bt->value = bf->value;
+			bf->value = tmp;
+		}
+	}
+}
+
+static void
+define(struct peephole *ctx, struct qbe_statement *stmt)
+{
+	struct ptemp *t = lookup(ctx, stmt->out->name);
+	++t->version;
+	t->block = ctx->block;
+	t->def = DEF_OTHER;
+	t->src = NULL;
+	t->alloc = false;
+
+	const struct qbe_value *a = stmt->args ? &stmt->args->value : NULL;
+	const struct qbe_value *b = a && stmt->args->next
+		? &stmt->args->next->value : NULL;
+	if (stmt->instr == Q_COPY) {
+		if (qclass(a->type) != qclass(stmt->out->type)
+				|| (a->kind == QV_CONST && !is_int(a->type))
+				|| (a->kind == QV_GLOBAL && a->threadlocal)) {
+			return;
+		}
+		t->def = DEF_COPY;
+		t->value = *a;
+	} else if ((stmt->instr == Q_CEQW || stmt->instr == Q_CNEW)
+			&& a->kind == QV_TEMPORARY && qclass(a->type) == Q_WORD
+			&& is_const(b, 0)) {
+		t->def = stmt->instr == Q_CEQW ? DEF_EQZ : DEF_NEZ;
+		t->value = *a;
+	} else if (is_compare(stmt->instr)) {
+		t->def = DEF_BOOL;
+		return;
+	} else {
+		return;
+	}
+	if (a->kind == QV_TEMPORARY) {
+		t->src = lookup(ctx, a->name);
+		t->src_version = t->src->version;
+	}
+}
+
+static void
+rewrite(struct peephole *ctx, struct qbe_statements *body, bool *removed)
+{
+	ctx->block = 1;
+	ctx->nfacts = 0;
+	for (size_t i = 0; i < body->ln; ++i) {
+		struct qbe_statement *stmt = &body->stmts[i];
+		if (stmt->type == Q_LABEL) {
+			++ctx->block;
+			ctx->nfacts = 0;
+			continue;
+		} else if (stmt->type != Q_INSTR || stmt->instr == Q_DBGLOC) {
+			continue;
+		}
+
+		for (struct qbe_arguments *arg = stmt->args;
+				arg; arg = arg->next) {
+			substitute(ctx, stmt, &arg->value);
+		}
+		simplify(stmt);
+
+		if ((stmt->instr == Q_EXTUB || stmt->instr == Q_EXTUH)
+				&& qclass(stmt->out->type) == Q_WORD
+				&& is_bool(ctx, &stmt->args->value)) {
+			stmt->instr = Q_COPY;
+		}
+
+		if (is_store(stmt->instr)) {
+			remember_store(ctx, stmt);
+		} else if (stmt->instr >= Q_LOADD && stmt->instr <= Q_LOADUW) {
+			forward_store(ctx, stmt);
+		} else if (stmt->instr == Q_CALL || stmt->instr == Q_BLIT
+				|| stmt->instr == Q_VAARG
+				|| stmt->instr == Q_VASTART) {
+			ctx->nfacts = 0;
+		} else if (stmt->instr == Q_JNZ) {
+			simplify_branch(ctx, stmt);
+		}
+
+		if (!stmt->out || stmt->out->kind != QV_TEMPORARY) {
+			continue;
+		}
+		if (stmt->instr == Q_COPY
+				&& stmt->args->value.kind == QV_TEMPORARY
+				&& strcmp(stmt->args->value.name,
+					stmt->out->name) == 0) {
+			removed[i] = true;
+			continue;
+		}
+		define(ctx, stmt);
+	}
+}
+
+// Removes definitions which are never used, or which are assigned again later
+// in the block before they're used. Returns the number removed.
+static size_t
+eliminate(struct peephole *ctx, const struct qbe_statements *prelude,
+	struct qbe_statements *body, bool *removed)
+{
+	for (size_t i = 0; i < ctx->sz; ++i) {
+		ctx->temps[i].uses = 0;
+		ctx->temps[i].killed = 0;
+	}
+	for (size_t i = 0; i < prelude->ln + body->ln; ++i) {
+		const struct qbe_statement *stmt = i < prelude->ln
+			? &prelude->stmts[i] : &body->stmts[i - prelude->ln];
+		if (stmt->type != Q_INSTR
+				|| (i >= prelude->ln && removed[i - prelude->ln])) {
+			continue;
+		}
+		for (struct qbe_arguments *arg = stmt->args;
+				arg; arg = arg->next) {
+			if (arg->value.kind == QV_TEMPORARY) {
+				++lookup(ctx, arg->value.name)->uses;
+			}
+		}
+	}
+
+	size_t n = 0, block = 1;
+	for (size_t i = body->ln; i > 0; --i) {
+		const struct qbe_statement *stmt = &body->stmts[i - 1];
+		if (stmt->type == Q_LABEL) {
+			++block;
+			continue;
+		} else if (removed[i - 1] || stmt->type != Q_INSTR) {
+			continue;
+		}
+		if (stmt->out && stmt->out->kind == QV_TEMPORARY) {
+			struct ptemp *t = lookup(ctx, stmt->out->name);
+			if (is_pure(stmt->instr)
+					&& (t->uses == 0 || t->killed == block)) {
+				for (struct qbe_arguments *arg = stmt->args;
+						arg; arg = arg->next) {
+					if (arg->value.kind == QV_TEMPORARY) {
+						--lookup(ctx, arg->value.name)->uses;
+					}
+				}
+				removed[i - 1] = true;
+				++n;
+				continue;
+			}
+			t->killed = block;
+		}
+		for (struct qbe_arguments *arg = stmt->args;
+				arg; arg = arg->next) {
+			if (arg->value.kind == QV_TEMPORARY) {
+				lookup(ctx, arg->value.name)->killed = 0;
+			}
+		}
+	}
+	return n;
+}
+
+static size_t
+peephole_func(struct qbe_func *func)
+{
+	struct peephole ctx = {0};
+	enter_temps(&ctx, &func->prelude);
+	enter_temps(&ctx, &func->body);
+	if (ctx.ntemps == 0) {
+		return 0;
+	}
+	for (size_t i = 0; i < func->prelude.ln; ++i) {
+		const struct qbe_statement *stmt = &func->prelude.stmts[i];
+		if (stmt->type == Q_INSTR && stmt->out
+				&& stmt->out->kind == QV_TEMPORARY) {
+			struct ptemp *t = lookup(&ctx, stmt->out->name);
+			t->alloc = stmt->instr >= Q_ALLOC16
+				&& stmt->instr <= Q_ALLOC8;
+		}
+	}
+	for (size_t i = 0; i < func->body.ln; ++i) {
+		const struct qbe_statement *stmt = &func->body.stmts[i];
+		if (stmt->type == Q_INSTR && stmt->out
+				&& stmt->out->kind == QV_TEMPORARY) {
+			lookup(&ctx, stmt->out->name)->alloc = false;
+		}
+	}
+
+	bool *removed = xcalloc(func->body.ln, sizeof(bool));
+	rewrite(&ctx, &func->body, removed);
+	while (eliminate(&ctx, &func->prelude, &func->body, removed) != 0) {
+		// Removing one definition may leave its operands unused
+	}
+
+	size_t n = 0;
+	for (size_t i = 0; i < func->body.ln; ++i) {
+		if (removed[i]) {
+			continue;
+		}
+		func->body.stmts[n++] = func->body.stmts[i];
+	}
+	size_t nremoved = func->body.ln - n;
+	func->body.ln = n;
+	free(removed);
+	free(ctx.temps);
+	return nremoved;
+}
+
+size_t
+opt_peephole(struct qbe_program *prog)
+{
+	size_t n = 0;
+	for (struct qbe_def *def = prog->defs; def; def = def->next) {
+		if (def->kind == Q_FUNC) {
+			n += peephole_func(&def->func);
+		}
+	}
+	return n;
+}
@@ -0,0 +1,172 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "check.h"
+#include "expr.h"
+#include "identifier.h"
+#include "opt.h"
+#include "scope.h"
+#include "types.h"
+#include "util.h"
+
+// Dead declaration elimination
+//
+// Unexported functions and globals have local symbols, so they can only be
+// referred to from this unit. Those which aren't reachable from an exported
+// declaration, the hosted main function, or an @init, @fini, or @test function
+// are removed from the unit before gen. A declaration is reached by naming it
+// anywhere in a reached function body or global initializer, which includes
+// taking its address; constant addresses are folded into literals which keep
+// the object they point into.
+
+#define PRUNE_BUCKETS 256
+
+struct prune_decl {
+	struct declarations *decls;
+	bool reached;
+	struct prune_decl *next;
+	struct prune_decl *lnext;
+};
+
+struct prune_state {
+	struct prune_decl *buckets[PRUNE_BUCKETS];
+	struct prune_decl *decls; // in unit order
+	struct prune_decl **queue;
+	size_t nqueue, queue_sz;
+};
+
+static void
+reach(struct prune_state *state, struct prune_decl *pd)
+{
+	if (pd->reached) {
+		return;
+	}
+	pd->reached = true;
+	if (state->nqueue >= state->queue_sz) {
+		state->queue_sz = state->queue_sz ? state->queue_sz * 2 : 64;
+		state->queue = xrealloc(state->queue,
+			state->queue_sz * sizeof(state->queue[0]));
+	}
+	state->queue[state->nqueue++] = pd;
+}
+
+static void
+reach_object(struct prune_state *state, const struct scope_object *obj)
+{
+	if (obj == NULL || obj->otype != O_DECL) {
+		return;
+	}
+	// A prototype and a definition may share a symbol, so each declaration
+	// with it is reached
+	char *sym = ident_to_sym(&obj->ident);
+	uint32_t hash = fnv1a_s(FNV1A_INIT, sym);
+	for (struct prune_decl *pd = state->buckets[hash % PRUNE_BUCKETS];
+			pd; pd = pd->next) {
+		if (strcmp(pd->decls->decl.symbol, sym) == 0) {
+			reach(state, pd);
+		}
+	}
+	free(sym);
+}
+
+static bool
+reach_visit(struct expression **slot, void *user)
+{
+	struct prune_state *state = user;
+	const struct expression *expr = *slot;
+	switch (expr->type) {
+	case EXPR_ACCESS:
+		if (expr->access.type == ACCESS_IDENTIFIER) {
+			reach_object(state, expr->access.object);
+		}
+		break;
+	case EXPR_LITERAL:
+		reach_object(state, expr->literal.object);
+		// expr_walk doesn't visit the members of slice literals
+		if (type_dealias(NULL, expr->result)->storage == STORAGE_SLICE) {
+			for (struct array_literal *item = expr->literal.array;
+					item; item = item->next) {
+				reach_visit(&item->value, user);
+				expr_walk(item->value, reach_visit, user);
+			}
+		}
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+static bool
+is_root(const struct declaration *decl, const char *mainsym)
+{
+	if (decl->exported || strcmp(decl->symbol, mainsym) == 0) {
+		return true;
+	}
+	return decl->decl_type == DECL_FUNC
+		&& (decl->func.flags & (FN_INIT | FN_FINI | FN_TEST));
+}
+
+void
+opt_prune(struct unit *unit, const char *mainsym)
+{
+	struct prune_state state = {0};
+	struct prune_decl **lnext = &state.decls;
+	for (struct declarations *decls = unit->declarations;
+			decls; decls = decls->next) {
+		const struct declaration *decl = &decls->decl;
+		if (decl->decl_type != DECL_FUNC
+				&& decl->decl_type != DECL_GLOBAL) {
+			continue;
+		}
+		assert(decl->symbol);
+		struct prune_decl *pd = xcalloc(1, sizeof(struct prune_decl));
+		pd->decls = decls;
+		uint32_t hash = fnv1a_s(FNV1A_INIT, decl->symbol);
+		pd->next = state.buckets[hash % PRUNE_BUCKETS];
+		state.buckets[hash % PRUNE_BUCKETS] = pd;
+		*lnext = pd;
+		lnext = &pd->lnext;
+		if (is_root(decl, mainsym)) {
+			reach(&state, pd);
+		}
+	}
+
+	while (state.nqueue != 0) {
+		struct declaration *decl = &state.queue[--state.nqueue]->decls->decl;
+		struct expression *root = NULL;
+		if (decl->decl_type == DECL_FUNC) {
+			root = decl->func.body;
+		} else {
+			root = decl->global.value;
+		}
+		if (root) {
+			reach_visit(&root, &state);
+			expr_walk(root, reach_visit, &state);
+		}
+	}
+
+	// The entries are in unit order, so the unit is pruned in step with them
+	struct declarations **next = &unit->declarations;
+	struct prune_decl *pd = state.decls;
+	while (*next) {
+		struct declarations *decls = *next;
+		if (!pd || pd->decls != decls) {
+			next = &decls->next;
+			continue;
+		}
+		if (pd->reached) {
+			next = &decls->next;
+		} else {
+			*next = decls->next;
+		}
+		struct prune_decl *lnext = pd->lnext;
+		free(pd);
+		pd = lnext;
+	}
+	free(state.queue);
+}
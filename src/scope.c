@@ -137,6 +137,9 @@ scope_lookup(struct scope *scope, const struct identifier *ident)
 	struct scope_object *bucket = scope->buckets[hash % SCOPE_BUCKETS];
 	while (bucket) {
 		if (identifier_eq(&bucket->name, ident)) {
+			if (bucket->otype == O_SCAN && scope->resolve) {
+				scope->resolve(bucket);
+			}
 			return bucket;
 		}
 		bucket = bucket->mnext;
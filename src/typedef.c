@@ -2,11 +2,14 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <math.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "check.h"
 #include "expr.h"
 #include "identifier.h"
+#include "opt.h"
+#include "scope.h"
 #include "typedef.h"
 #include "util.h"
 
@@ -53,6 +56,34 @@ storage_to_suffix(enum type_storage storage)
 	}
 }
 
+static void
+emit_packed(const struct type *membtype,
+	const struct packed_literal *packed, FILE *out)
+{
+	membtype = type_dealias(NULL, membtype);
+	const unsigned char *data = (const unsigned char *)packed->data;
+	for (size_t i = 0; i < packed->len; i += membtype->size) {
+		uint64_t val = 0;
+		for (size_t j = membtype->size; j > 0; --j) {
+			val = val << 8 | data[i + j - 1];
+		}
+		size_t bits = membtype->size * 8;
+		if (type_is_signed(NULL, membtype)) {
+			if (bits < 64 && (val >> (bits - 1) & 1)) {
+				val |= UINT64_MAX << bits;
+			}
+			xfprintf(out, "%" PRIi64 "%s", (int64_t)val,
+				storage_to_suffix(membtype->storage));
+		} else {
+			xfprintf(out, "%" PRIu64 "%s", val,
+				storage_to_suffix(membtype->storage));
+		}
+		if (i + membtype->size < packed->len) {
+			xfprintf(out, ", ");
+		}
+	}
+}
+
 static void
 emit_literal(const struct expression *expr, FILE *out)
 {
@@ -109,8 +140,8 @@ emit_literal(const struct expression *expr, FILE *out)
 	case STORAGE_STRING:
 		xfprintf(out, "\"");
 		for (size_t i = 0; i < val->string.len; i += 1) {
-			char c = val->string.value[i];
-			if (isalnum((unsigned char)c)) {
+			unsigned char c = val->string.value[i];
+			if (isalnum(c)) {
 				xfprintf(out, "%c", c);
 			} else {
 				xfprintf(out, "\\x%02X", c);
@@ -138,6 +169,9 @@ emit_literal(const struct expression *expr, FILE *out)
 		break;
 	case STORAGE_ARRAY:
 		xfprintf(out, "[");
+		if (val->packed) {
+			emit_packed(t->array.members, val->packed, out);
+		}
 		for (const struct array_literal *item = val->array;
 				item; item = item->next) {
 			emit_literal(item->value, out);
@@ -331,11 +365,302 @@ emit_decl_const(struct declaration *decl, FILE *out)
 	xfprintf(out, ";\n");
 }
 
+// The bodies of small exported functions are written to the typedefs, so that
+// importers can inline them; calls which aren't inlined still refer to the
+// external symbol. Only a subset of expressions which refer to nothing but the
+// function's parameters is written, so that the body checks the same way in
+// every importer.
+
+static const char *binarithm_ops[] = {
+	[BIN_BAND] = "&",
+	[BIN_BOR] = "|",
+	[BIN_DIV] = "/",
+	[BIN_GREATER] = ">",
+	[BIN_GREATEREQ] = ">=",
+	[BIN_LAND] = "&&",
+	[BIN_LEQUAL] = "==",
+	[BIN_LESS] = "<",
+	[BIN_LESSEQ] = "<=",
+	[BIN_LOR] = "||",
+	[BIN_LSHIFT] = "<<",
+	[BIN_LXOR] = "^^",
+	[BIN_MINUS] = "-",
+	[BIN_MODULO] = "%",
+	[BIN_NEQUAL] = "!=",
+	[BIN_PLUS] = "+",
+	[BIN_RSHIFT] = ">>",
+	[BIN_TIMES] = "*",
+	[BIN_BXOR] = "^",
+};
+
+static const char *unarithm_ops[] = {
+	[UN_ADDRESS] = "&",
+	[UN_BNOT] = "~",
+	[UN_DEREF] = "*",
+	[UN_LNOT] = "!",
+	[UN_MINUS] = "-",
+};
+
+// Whether a type can be spelled in the typedefs
+static bool
+type_exportable(const struct type *type)
+{
+	switch (type->storage) {
+	case STORAGE_ALIAS:
+	case STORAGE_ENUM:
+		return type->alias.exported;
+	case STORAGE_ARRAY:
+	case STORAGE_SLICE:
+		return type_exportable(type->array.members);
+	case STORAGE_FUNCTION:
+		for (const struct type_func_param *param = type->func.params;
+				param; param = param->next) {
+			if (!type_exportable(param->type)) {
+				return false;
+			}
+		}
+		return type_exportable(type->func.result);
+	case STORAGE_POINTER:
+		return type_exportable(type->pointer.referent);
+	case STORAGE_STRUCT:
+	case STORAGE_UNION:
+		for (const struct struct_field *field = type->struct_union.fields;
+				field; field = field->next) {
+			if (!type_exportable(field->type)) {
+				return false;
+			}
+		}
+		return true;
+	case STORAGE_TAGGED:
+		for (const struct type_tagged_union *tu = &type->tagged;
+				tu; tu = tu->next) {
+			if (!type_exportable(tu->type)) {
+				return false;
+			}
+		}
+		return true;
+	case STORAGE_TUPLE:
+		for (const struct type_tuple *t = &type->tuple; t; t = t->next) {
+			if (!type_exportable(t->type)) {
+				return false;
+			}
+		}
+		return true;
+	case STORAGE_ERROR:
+	case STORAGE_FCONST:
+	case STORAGE_ICONST:
+	case STORAGE_RCONST:
+		return false;
+	default:
+		return true;
+	}
+}
+
+static bool
+is_param(const struct scope *params, const struct scope_object *obj)
+{
+	for (const struct scope_object *p = params->objects; p; p = p->lnext) {
+		if (p == obj) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool
+body_exportable(const struct expression *expr,
+	const struct scope *params, size_t *nodes)
+{
+	if (++*nodes > INLINE_BUDGET || !type_exportable(expr->result)) {
+		return false;
+	}
+	switch (expr->type) {
+	case EXPR_ACCESS:
+		switch (expr->access.type) {
+		case ACCESS_IDENTIFIER:
+			return is_param(params, expr->access.object);
+		case ACCESS_INDEX:
+			return body_exportable(expr->access.array, params, nodes)
+				&& body_exportable(expr->access.index, params, nodes);
+		case ACCESS_FIELD:
+			return expr->access.field->name
+				&& body_exportable(expr->access._struct, params, nodes);
+		case ACCESS_TUPLE:
+			return body_exportable(expr->access.tuple, params, nodes);
+		}
+		assert(0);
+	case EXPR_ASSIGN:
+		return body_exportable(expr->assign.object, params, nodes)
+			&& body_exportable(expr->assign.value, params, nodes);
+	case EXPR_BINARITHM:
+		return body_exportable(expr->binarithm.lvalue, params, nodes)
+			&& body_exportable(expr->binarithm.rvalue, params, nodes);
+	case EXPR_CAST:
+		return expr->cast.kind == C_CAST
+			&& body_exportable(expr->cast.value, params, nodes);
+	case EXPR_COMPOUND:
+		if (expr->compound.label) {
+			return false;
+		}
+		for (const struct expressions *exprs = &expr->compound.exprs;
+				exprs; exprs = exprs->next) {
+			if (!body_exportable(exprs->expr, params, nodes)) {
+				return false;
+			}
+		}
+		return true;
+	case EXPR_IF:
+		return body_exportable(expr->_if.cond, params, nodes)
+			&& body_exportable(expr->_if.true_branch, params, nodes)
+			&& (!expr->_if.false_branch || body_exportable(
+				expr->_if.false_branch, params, nodes));
+	case EXPR_LEN:
+		return body_exportable(expr->len.value, params, nodes);
+	case EXPR_LITERAL:
+		if (expr->literal.object || expr->literal.packed) {
+			return false;
+		}
+		switch (type_dealias(NULL, expr->result)->storage) {
+		case STORAGE_ARRAY:
+		case STORAGE_SLICE:
+		case STORAGE_STRUCT:
+		case STORAGE_TAGGED:
+		case STORAGE_TUPLE:
+		case STORAGE_UNION:
+			return false;
+		default:
+			return true;
+		}
+	case EXPR_RETURN:
+		return !expr->_return.value
+			|| body_exportable(expr->_return.value, params, nodes);
+	case EXPR_UNARITHM:
+		return body_exportable(expr->unarithm.operand, params, nodes);
+	case EXPR_YIELD:
+		// Compounds aren't labelled, so this yields to the innermost,
+		// which includes those yields added to the end by check
+		return !expr->control.label && (!expr->control.value
+			|| body_exportable(expr->control.value, params, nodes));
+	default:
+		return false;
+	}
+}
+
+// Subexpressions are parenthesized wherever precedence could matter
+static void
+emit_body(const struct expression *expr, FILE *out)
+{
+	switch (expr->type) {
+	case EXPR_ACCESS:
+		switch (expr->access.type) {
+		case ACCESS_IDENTIFIER:
+			xfprintf(out, "%s", expr->access.object->name.name);
+			break;
+		case ACCESS_INDEX:
+			emit_body(expr->access.array, out);
+			xfprintf(out, "[");
+			emit_body(expr->access.index, out);
+			xfprintf(out, "]");
+			break;
+		case ACCESS_FIELD:
+			emit_body(expr->access._struct, out);
+			xfprintf(out, ".%s", expr->access.field->name);
+			break;
+		case ACCESS_TUPLE:
+			xfprintf(out, "(");
+			emit_body(expr->access.tuple, out);
+			xfprintf(out, ").%zu", expr->access.tindex);
+			break;
+		}
+		break;
+	case EXPR_ASSIGN:
+		emit_body(expr->assign.object, out);
+		if (expr->assign.op == BIN_LEQUAL) {
+			xfprintf(out, " = ");
+		} else {
+			xfprintf(out, " %s= ", binarithm_ops[expr->assign.op]);
+		}
+		emit_body(expr->assign.value, out);
+		break;
+	case EXPR_BINARITHM:
+		xfprintf(out, "(");
+		emit_body(expr->binarithm.lvalue, out);
+		xfprintf(out, " %s ", binarithm_ops[expr->binarithm.op]);
+		emit_body(expr->binarithm.rvalue, out);
+		xfprintf(out, ")");
+		break;
+	case EXPR_CAST:
+		xfprintf(out, "(");
+		emit_body(expr->cast.value, out);
+		xfprintf(out, ": ");
+		emit_type(expr->cast.secondary, out);
+		xfprintf(out, ")");
+		break;
+	case EXPR_COMPOUND:
+		xfprintf(out, "{ ");
+		for (const struct expressions *exprs = &expr->compound.exprs;
+				exprs; exprs = exprs->next) {
+			emit_body(exprs->expr, out);
+			xfprintf(out, "; ");
+		}
+		xfprintf(out, "}");
+		break;
+	case EXPR_IF:
+		xfprintf(out, "(if (");
+		emit_body(expr->_if.cond, out);
+		xfprintf(out, ") ");
+		emit_body(expr->_if.true_branch, out);
+		if (expr->_if.false_branch) {
+			xfprintf(out, " else ");
+			emit_body(expr->_if.false_branch, out);
+		}
+		xfprintf(out, ")");
+		break;
+	case EXPR_LEN:
+		xfprintf(out, "len(");
+		emit_body(expr->len.value, out);
+		xfprintf(out, ")");
+		break;
+	case EXPR_LITERAL:
+		xfprintf(out, "(");
+		emit_literal(expr, out);
+		xfprintf(out, ")");
+		break;
+	case EXPR_RETURN:
+		xfprintf(out, "return");
+		if (expr->_return.value) {
+			xfprintf(out, " ");
+			emit_body(expr->_return.value, out);
+		}
+		break;
+	case EXPR_UNARITHM:
+		xfprintf(out, "(%s ", unarithm_ops[expr->unarithm.op]);
+		emit_body(expr->unarithm.operand, out);
+		xfprintf(out, ")");
+		break;
+	case EXPR_YIELD:
+		xfprintf(out, "yield");
+		if (expr->control.value) {
+			xfprintf(out, " ");
+			emit_body(expr->control.value, out);
+		}
+		break;
+	default:
+		assert(0); // Invariant
+	}
+}
+
 static void
-emit_decl_func(struct declaration *decl, FILE *out)
+emit_decl_func(struct declaration *decl, bool bodies, FILE *out)
 {
 	char *ident = identifier_unparse(&decl->ident);
 	const struct type *fntype = decl->func.type;
+	size_t nodes = 0;
+	bool body = bodies && decl->func.body
+		&& fntype->func.variadism == VARIADISM_NONE
+		&& body_exportable(decl->func.body, decl->func.scope, &nodes);
+	// The body refers to the parameters by name
+	const struct scope_object *name = body ? decl->func.scope->objects : NULL;
 	xfprintf(out, "export ");
 	if (decl->symbol) {
 		xfprintf(out, "@symbol(\"%s\") ", decl->symbol);
@@ -344,6 +669,10 @@ emit_decl_func(struct declaration *decl, FILE *out)
 
 	for (struct type_func_param *param = fntype->func.params;
 			param; param = param->next) {
+		if (name) {
+			xfprintf(out, "%s: ", name->name.name);
+			name = name->lnext;
+		}
 		if (param->next) {
 			emit_type(param->type, out);
 			xfprintf(out, ", ");
@@ -360,6 +689,10 @@ emit_decl_func(struct declaration *decl, FILE *out)
 
 	xfprintf(out, ") ");
 	emit_type(fntype->func.result, out);
+	if (body) {
+		xfprintf(out, " = ");
+		emit_body(decl->func.body, out);
+	}
 	xfprintf(out, ";\n");
 	free(ident);
 }
@@ -424,7 +757,7 @@ emit_decl_type(struct declaration *decl, FILE *out)
 }
 
 void
-emit_typedefs(struct unit *unit, FILE *out)
+emit_typedefs(struct unit *unit, bool bodies, FILE *out)
 {
 	for (struct identifiers *imports = unit->imports;
 			imports; imports = imports->next) {
@@ -445,7 +778,7 @@ emit_typedefs(struct unit *unit, FILE *out)
 			emit_decl_const(decl, out);
 			break;
 		case DECL_FUNC:
-			emit_decl_func(decl, out);
+			emit_decl_func(decl, bodies, out);
 			break;
 		case DECL_GLOBAL:
 			emit_decl_global(decl, out);
@@ -649,25 +649,32 @@ lower_flexible(struct context *ctx, const struct type *old, const struct type *n
 const struct type *
 promote_flexible(struct context *ctx,
 		const struct type *a, const struct type *b) {
-	if (a->storage == STORAGE_ICONST && b->storage == STORAGE_ICONST) {
-		int64_t min = a->flexible.min < b->flexible.min
-			? a->flexible.min : b->flexible.min;
-		int64_t max = a->flexible.max > b->flexible.max
-			? a->flexible.max : b->flexible.max;
-		const struct type *l =
-			type_create_flexible(STORAGE_ICONST, min, max);
-		lower_flexible(ctx, a, l);
-		lower_flexible(ctx, b, l);
-		return l;
+	if (type_is_flexible(a) && a->storage == b->storage) {
+		if (a == b) {
+			return a;
+		}
+		// The type with more references absorbs the other, so that
+		// promoting many constants in turn (say, the members of a long
+		// array literal) doesn't move all of the references every time
+		if (a->flexible.nrefs < b->flexible.nrefs) {
+			const struct type *tmp = a;
+			a = b;
+			b = tmp;
+		}
+		if (a->storage == STORAGE_ICONST) {
+			struct type_flexible *flex =
+				(struct type_flexible *)&a->flexible;
+			if (b->flexible.min < flex->min) {
+				flex->min = b->flexible.min;
+			}
+			if (b->flexible.max > flex->max) {
+				flex->max = b->flexible.max;
+			}
+		}
+		lower_flexible(ctx, b, a);
+		return a;
 	}
 	if (type_is_flexible(a)) {
-		if (a->storage == b->storage) {
-			const struct type *l =
-				type_create_flexible(a->storage, 0, 0);
-			lower_flexible(ctx, a, l);
-			lower_flexible(ctx, b, l);
-			return l;
-		}
 		if (type_is_flexible(b)) {
 			return NULL;
 		}